@@ -0,0 +1,249 @@
+// Tick throughput benchmark for the simulation core
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "cells.h"
+#include "defines.h"
+#include "util.h"
+
+#define BENCH_MAX_VALUES 32
+
+struct bench_list
+{
+	uint64_t values[BENCH_MAX_VALUES];
+	unsigned count;
+};
+
+struct bench_result
+{
+	unsigned size;
+	unsigned density;
+	uint64_t seed;
+	unsigned threads;
+	enum cells_tick_mode tickMode;
+	unsigned ticks;
+
+	double seconds;
+	unsigned long long aliveCellUpdates;
+	unsigned long long instructions;
+	unsigned aliveAtEnd;
+	size_t stateBytes;
+	long maxRssKb;
+};
+
+static void usage(const char *program)
+{
+	printf("Usage: %s [options]\n", program);
+	printf("Runs cells_update_state() for every combination of the lists below.\n");
+	printf("  -z, --sizes LIST      world sides ( default 64,256,1024 )\n");
+	printf("  -d, --densities LIST  initial density in percent ( default 5,20,50 )\n");
+	printf("  -s, --seeds LIST      seeds ( default 1,2,3 )\n");
+	printf("  -t, --threads LIST    thread counts ( default 1 )\n");
+	printf("  -m, --tick-mode MODE  in-place ( default ) or once\n");
+	printf("  -n, --ticks N         measured ticks per run ( default 200 )\n");
+	printf("  -u, --warmup N        ticks run before measuring ( default 20 )\n");
+	printf("  -p, --param N=V       set simulation parameter N, see cells_set_param() for names\n");
+	printf("  -j, --json            print JSON lines instead of CSV\n");
+	printf("      --help            show this message\n");
+}
+
+// parses comma separated list of numbers
+static struct bench_list bench_parse_list(const char *option, const char *value, const uint64_t min, const uint64_t max)
+{
+	struct bench_list list = {0};
+	char buf[1024];
+
+	snprintf(buf, sizeof(buf), "%s", value);
+
+	for (char *save, *token = strtok_r(buf, ",", &save); token; token = strtok_r(NULL, ",", &save))
+	{
+		if (list.count == BENCH_MAX_VALUES)
+		{
+			fprintf(stderr, "too many values for %s, at most %d are supported\n", option, BENCH_MAX_VALUES);
+			exit(EXIT_FAILURE);
+		}
+
+		list.values[list.count++] = util_parse_number(option, token, min, max);
+	}
+
+	if (list.count == 0)
+	{
+		fprintf(stderr, "empty list for %s\n", option);
+		exit(EXIT_FAILURE);
+	}
+
+	return list;
+}
+
+static double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct bench_result bench_run(const unsigned size, const unsigned density, const uint64_t seed, const unsigned threads,
+									 const enum cells_tick_mode tickMode, const unsigned ticks, const unsigned warmup,
+									 const struct cells_params *params)
+{
+	struct bench_result result = {size, density, seed, threads, tickMode, ticks};
+
+	struct cells_state *state = cells_init(size, size, seed, params, density);
+	cells_set_threads(state, threads);
+	state->tickMode = tickMode;
+
+	for (unsigned i = 0; i < warmup; i++)
+		cells_update_state(state);
+
+	// only the ticks are timed, counting alive cells stays outside
+	for (unsigned i = 0; i < ticks; i++)
+	{
+		result.aliveCellUpdates += cells_count_alive_cells(state);
+
+		const unsigned long long instructions = state->instructions;
+
+		double start = bench_now();
+		cells_update_state(state);
+		result.seconds += bench_now() - start;
+
+		result.instructions += state->instructions - instructions;
+	}
+
+	result.aliveAtEnd = cells_count_alive_cells(state);
+	result.stateBytes = cells_memory_usage(state);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	result.maxRssKb = usage.ru_maxrss;
+
+	cells_quit(state);
+
+	return result;
+}
+
+static void bench_print(const struct bench_result *r, const bool json)
+{
+	const double cells = (double)r->size * r->size * r->ticks;
+	const double ticksPerSecond = r->ticks / r->seconds;
+	const double nsPerCell = r->seconds * 1e9 / cells;
+	const double aliveUpdatesPerSecond = r->aliveCellUpdates / r->seconds;
+	const double instructionsPerSecond = r->instructions / r->seconds;
+	const char *tickMode = r->tickMode == TICK_ONCE ? "once" : "in-place";
+
+	if (json)
+		printf("{\"size\":%u,\"density\":%u,\"seed\":%llu,\"threads\":%u,\"tick_mode\":\"%s\",\"ticks\":%u,\"seconds\":%.6f,"
+			   "\"ticks_per_second\":%.2f,\"ns_per_cell\":%.3f,\"alive_updates_per_second\":%.0f,\"instructions_per_second\":%.0f,"
+			   "\"alive_at_end\":%u,\"state_bytes\":%zu,\"max_rss_kb\":%ld}\n",
+			   r->size, r->density, (unsigned long long)r->seed, r->threads, tickMode, r->ticks, r->seconds,
+			   ticksPerSecond, nsPerCell, aliveUpdatesPerSecond, instructionsPerSecond, r->aliveAtEnd, r->stateBytes, r->maxRssKb);
+	else
+		printf("%u,%u,%llu,%u,%s,%u,%.6f,%.2f,%.3f,%.0f,%.0f,%u,%zu,%ld\n",
+			   r->size, r->density, (unsigned long long)r->seed, r->threads, tickMode, r->ticks, r->seconds,
+			   ticksPerSecond, nsPerCell, aliveUpdatesPerSecond, instructionsPerSecond, r->aliveAtEnd, r->stateBytes, r->maxRssKb);
+
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_list sizes = bench_parse_list("--sizes", "64,256,1024", 1, 65535);
+	struct bench_list densities = bench_parse_list("--densities", "5,20,50", 0, 100);
+	struct bench_list seeds = bench_parse_list("--seeds", "1,2,3", 0, UINT64_MAX);
+	struct bench_list threads = bench_parse_list("--threads", "1", 1, 1024);
+	enum cells_tick_mode tickMode = TICK_IN_PLACE;
+	unsigned ticks = 200;
+	unsigned warmup = 20;
+	bool json = false;
+	struct cells_params params = cells_default_params();
+
+	enum
+	{
+		OPTION_HELP = 256,
+	};
+
+	const struct option options[] = {
+		{"sizes", required_argument, NULL, 'z'},
+		{"densities", required_argument, NULL, 'd'},
+		{"seeds", required_argument, NULL, 's'},
+		{"threads", required_argument, NULL, 't'},
+		{"tick-mode", required_argument, NULL, 'm'},
+		{"ticks", required_argument, NULL, 'n'},
+		{"warmup", required_argument, NULL, 'u'},
+		{"param", required_argument, NULL, 'p'},
+		{"json", no_argument, NULL, 'j'},
+		{"help", no_argument, NULL, OPTION_HELP},
+		{0},
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "z:d:s:t:m:n:u:p:j", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'z':
+			sizes = bench_parse_list("--sizes", optarg, 1, 65535);
+			break;
+		case 'd':
+			densities = bench_parse_list("--densities", optarg, 0, 100);
+			break;
+		case 's':
+			seeds = bench_parse_list("--seeds", optarg, 0, UINT64_MAX);
+			break;
+		case 't':
+			threads = bench_parse_list("--threads", optarg, 1, 1024);
+			break;
+		case 'm':
+			if (!cells_parse_tick_mode(optarg, &tickMode))
+			{
+				fprintf(stderr, "unknown tick mode '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			ticks = util_parse_number("--ticks", optarg, 1, UINT32_MAX);
+			break;
+		case 'u':
+			warmup = util_parse_number("--warmup", optarg, 0, UINT32_MAX);
+			break;
+		case 'p':
+			if (!cells_parse_param(&params, optarg))
+			{
+				fprintf(stderr, "expected NAME=VALUE of a known parameter for --param, got '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'j':
+			json = true;
+			break;
+		case OPTION_HELP:
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!json)
+		printf("size,density,seed,threads,tick_mode,ticks,seconds,ticks_per_second,ns_per_cell,alive_updates_per_second,instructions_per_second,"
+			   "alive_at_end,state_bytes,max_rss_kb\n");
+
+	for (unsigned z = 0; z < sizes.count; z++)
+		for (unsigned d = 0; d < densities.count; d++)
+			for (unsigned s = 0; s < seeds.count; s++)
+				for (unsigned t = 0; t < threads.count; t++)
+				{
+					struct bench_result result = bench_run(sizes.values[z], densities.values[d], seeds.values[s],
+														   threads.values[t], tickMode, ticks, warmup, &params);
+					bench_print(&result, json);
+				}
+
+	return EXIT_SUCCESS;
+}
@@ -1,58 +1,201 @@
 #include "cells.h"
+#include "pool.h"
 #include "util.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-struct instruction cells_generate_instruction()
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct cells_params cells_default_params(void)
+{
+	return (struct cells_params){
+		.genomeLength = GENOME_LENGTH,
+		.mutationPercent = MUTATION_PERCENT,
+		.startEnergy = START_ENERGY,
+		.reproductionEnergy = REPRODUCTION_REQUIRED_ENERGY,
+		.maxAge = CELL_MAX_AGE,
+		.photosynthesisEnergy = PHOTOSYNTHESIS_ENERGY,
+		.attackCost = ATTACK_REQUIRED_ENERGY,
+		.attackEnergy = ATTACK_ENERGY,
+		.moveCost = MOVEMENT_COST,
+		.turnCost = TURN_COST,
+		.noopCost = NOOP_COST,
+	};
+}
+
+struct cells_param
+{
+	const char *name;
+	size_t offset;
+	// float field, otherwise unsigned
+	bool real;
+	double min, max;
+};
+
+static const struct cells_param cells_param_table[] = {
+	{"genome-length", offsetof(struct cells_params, genomeLength), false, 1, GENOME_MAX_LENGTH},
+	{"mutation-percent", offsetof(struct cells_params, mutationPercent), false, 0, 100},
+	{"start-energy", offsetof(struct cells_params, startEnergy), true, 0, 1e6},
+	// instructions keep energy arguments up to twice of it in 6 bits
+	{"reproduction-energy", offsetof(struct cells_params, reproductionEnergy), false, 1, 31},
+	{"max-age", offsetof(struct cells_params, maxAge), false, 1, 1 << 30},
+	{"photosynthesis-energy", offsetof(struct cells_params, photosynthesisEnergy), false, 0, 1000},
+	{"attack-cost", offsetof(struct cells_params, attackCost), true, 0, 1000},
+	{"attack-energy", offsetof(struct cells_params, attackEnergy), true, 0, 1},
+	{"move-cost", offsetof(struct cells_params, moveCost), true, 0, 1000},
+	{"turn-cost", offsetof(struct cells_params, turnCost), true, 0, 1000},
+	{"noop-cost", offsetof(struct cells_params, noopCost), true, 0, 1000},
+};
+
+#define CELLS_PARAM_COUNT (sizeof(cells_param_table) / sizeof(cells_param_table[0]))
+
+bool cells_set_param(struct cells_params *params, const char *name, const char *value)
+{
+	for (size_t i = 0; i < CELLS_PARAM_COUNT; i++)
+	{
+		const struct cells_param *param = &cells_param_table[i];
+		void *field = (char *)params + param->offset;
+
+		if (strcmp(name, param->name) != 0)
+			continue;
+
+		if (param->real)
+			*(float *)field = util_parse_float(name, value, param->min, param->max);
+		else
+			*(unsigned *)field = util_parse_number(name, value, param->min, param->max);
+
+		return true;
+	}
+
+	return false;
+}
+
+bool cells_parse_param(struct cells_params *params, const char *pair)
+{
+	const char *value = strchr(pair, '=');
+	char name[64];
+
+	if (!value || value - pair >= (long)sizeof(name))
+		return false;
+
+	memcpy(name, pair, value - pair);
+	name[value - pair] = '\0';
+
+	return cells_set_param(params, name, value + 1);
+}
+
+bool cells_load_params(struct cells_params *params, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+	{
+		perror(path);
+		return false;
+	}
+
+	char line[1024];
+	unsigned number = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), f))
+	{
+		number++;
+		line[strcspn(line, "#")] = '\0';
+
+		char *saveptr;
+		for (char *pair = strtok_r(line, " \t\r\n", &saveptr); pair; pair = strtok_r(NULL, " \t\r\n", &saveptr))
+		{
+			if (!cells_parse_param(params, pair))
+			{
+				fprintf(stderr, "%s:%u: expected name=value of a known parameter, got '%s'\n", path, number, pair);
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	fclose(f);
+	return ok;
+}
+
+bool cells_check_params(const struct cells_params *params)
+{
+	for (size_t i = 0; i < CELLS_PARAM_COUNT; i++)
+	{
+		const struct cells_param *param = &cells_param_table[i];
+		const void *field = (const char *)params + param->offset;
+		const double value = param->real ? *(const float *)field : *(const unsigned *)field;
+
+		// comparisons are false for NaN
+		if (!(value >= param->min && value <= param->max))
+			return false;
+	}
+
+	return true;
+}
+
+struct instruction cells_generate_instruction(struct util_rng *rng, const struct cells_params *params)
 {
 	struct instruction instruction;
 
-	instruction.command = util_random(0, MAKE_CHILD);
+	instruction.command = util_rng_range(rng, 0, MAKE_CHILD);
 
-	instruction.opt = rand() > RAND_MAX / 2;
-	instruction.e = util_random(0, REPRODUCTION_REQUIRED_ENERGY * 2);
-	instruction.b1 = util_random(0, GENOME_LENGTH);
-	instruction.b2 = util_random(0, GENOME_LENGTH);
-	instruction.b3 = util_random(0, GENOME_LENGTH);
-	instruction.b4 = util_random(0, GENOME_LENGTH);
+	instruction.opt = util_rng_bool(rng);
+	instruction.e = util_rng_range(rng, 0, params->reproductionEnergy * 2);
+	instruction.b1 = util_rng_range(rng, 0, params->genomeLength);
+	instruction.b2 = util_rng_range(rng, 0, params->genomeLength);
+	instruction.b3 = util_rng_range(rng, 0, params->genomeLength);
+	instruction.b4 = util_rng_range(rng, 0, params->genomeLength);
 
 	return instruction;
 }
 
-struct cell cells_generate_cell(const unsigned x, const unsigned y)
+struct cell cells_generate_cell(struct util_rng *rng, const struct cells_params *params, const unsigned x, const unsigned y)
 {
-	struct cell cell;
+	struct cell cell = {0};
 
 	// generating genome
-	for (int i = 0; i < GENOME_LENGTH; i++)
+	for (unsigned i = 0; i < params->genomeLength; i++)
 	{
-		cell.genome[i] = cells_generate_instruction();
+		cell.genome[i] = cells_generate_instruction(rng, params);
 	}
 
 	cell.currentInstruction = 0;
-	cell.direction = util_random(0, 3);
-	cell.energy = START_ENERGY;
+	cell.direction = util_rng_range(rng, 0, 3);
+	cell.energy = params->startEnergy;
 	cell.alive = true;
 	cell.empty = false;
 	cell.age = 0;
 
 	cell.x = x, cell.y = y;
 
-	cell.r = util_random(0, 255);
-	cell.g = util_random(0, 255);
-	cell.b = util_random(0, 255);
+	cell.r = util_rng_range(rng, 0, 255);
+	cell.g = util_rng_range(rng, 0, 255);
+	cell.b = util_rng_range(rng, 0, 255);
+
+	cell.photosynthesisCount = 0;
+	cell.attackCount = 0;
+	cell.eatingDeadCount = 0;
 
 	return cell;
 }
 
 struct cell cells_generate_empty_cell(const unsigned x, const unsigned y)
 {
-	struct cell cell;
+	struct cell cell = {0};
 
 	cell.alive = false;
 	cell.empty = true;
+	cell.energy = 0;
 	cell.age = 0;
 
 	cell.x = x, cell.y = y;
@@ -60,414 +203,2375 @@ struct cell cells_generate_empty_cell(const unsigned x, const unsigned y)
 	return cell;
 }
 
-void cells_update_cell(struct cells_state *state, struct cell cell)
+// sets alive flag together with its bit in state->aliveBits
+static inline void cells_set_alive(struct cells_state *state, const size_t index, const bool alive)
 {
-	assert(state);
+	uint64_t *word = &state->aliveBits[index / 64];
+	const uint64_t bit = 1ull << (index % 64);
 
-	if (!cell.alive)
-		return;
+	state->alive[index] = alive;
 
-	struct instruction currentInstruction = cell.genome[cell.currentInstruction];
-	unsigned nextInstruction = cell.currentInstruction + 1;
-	float consumedEnergy = NOOP_COST;
+	// neighbouring tiles may share the word
+	if (alive)
+		__atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+	else
+		__atomic_fetch_and(word, ~bit, __ATOMIC_RELAXED);
 
-	int facingX = cell.x, facingY = cell.y;
-	switch (cell.direction)
-	{
-	case LEFT:
-		facingX = cell.x - 1;
-		break;
-	case RIGHT:
-		facingX = cell.x + 1;
-		break;
-	case UP:
-		facingY = cell.y - 1;
-		break;
-	case DOWN:
-		facingY = cell.y + 1;
-	}
+	// every change of alive, empty or colour goes through here, so that's where it's recorded
+	// neighbouring tiles may share the span, they store the same version
+	__atomic_store_n(&state->spanVersions[index / SPAN_SIZE], state->version, __ATOMIC_RELAXED);
+}
 
-	if (facingX == -1)
-		facingX = state->width - 1;
-	else if (facingX == state->width)
-		facingX = 0;
+// turns slot into empty space, without starting a new version
+static void cells_empty_slot(struct cells_state *state, const size_t index)
+{
+	genome_pool_release(state->genomePool, state->genomes[index]);
+	state->genomes[index] = GENOME_NONE;
+	lineage_pool_release(state->lineagePool, state->lineages[index]);
+	state->lineages[index] = LINEAGE_NONE;
+
+	cells_set_alive(state, index, false);
+	state->empty[index] = true;
+	state->energy[index] = 0;
+	state->age[index] = 0;
+}
 
-	if (facingY == -1)
-		facingY = state->height - 1;
-	else if (facingY == state->height)
-		facingY = 0;
+static void cells_lineage_birth(struct cells_lineage_events *events, const lineage_handle lineage)
+{
+	if (events->birthCount == events->birthCapacity)
+	{
+		events->birthCapacity = events->birthCapacity ? events->birthCapacity * 2 : 64;
+		events->births = realloc(events->births, events->birthCapacity * sizeof(*events->births));
+		assert(events->births);
+	}
 
-	struct cell *frontCell;
+	events->births[events->birthCount++] = lineage;
+}
 
-	switch (cell.genome[cell.currentInstruction].command)
+static void cells_lineage_extinction(struct cells_lineage_events *events, const uint64_t id)
+{
+	if (events->extinctionCount == events->extinctionCapacity)
 	{
-	case NOOP:
-		break;
-
-	case TURN_LEFT:
-		if (cell.direction - 1 == -1)
-			cell.direction = DOWN;
-		else
-			cell.direction--;
+		events->extinctionCapacity = events->extinctionCapacity ? events->extinctionCapacity * 2 : 64;
+		events->extinctions = realloc(events->extinctions, events->extinctionCapacity * sizeof(*events->extinctions));
+		assert(events->extinctions);
+	}
 
-		consumedEnergy += TURN_COST;
-		break;
+	events->extinctions[events->extinctionCount++] = id;
+}
 
-	case TURN_RIGHT:
-		if (cell.direction + 1 == 4)
-			cell.direction = LEFT;
-		else
-			cell.direction++;
+// alive cell with given offset died, its lineage may have died out with it
+static inline void cells_lineage_death(struct cells_state *state, struct cells_lineage_events *events, const size_t index)
+{
+	const lineage_handle lineage = state->lineages[index];
 
-		consumedEnergy += TURN_COST;
-		break;
+	// pending lineages are checked when their birth is logged
+	if (lineage_pool_died(state->lineagePool, lineage) && !lineage_pool_get(state->lineagePool, lineage)->pending)
+		cells_lineage_extinction(events, lineage_pool_get(state->lineagePool, lineage)->id);
+}
 
-	case MOVE_FORWARDS:
-		// checking if space, where cell wants to move is empty
-		// if it is not, cell won't move
-		if (cells_get_cell(state, facingX, facingY)->empty)
-		{
-			cells_set_cell(state, cell.x, cell.y, cells_generate_empty_cell(cell.x, cell.y));
-			cell.x = facingX, cell.y = facingY;
-		}
+// source of most of the energy, ties go to the first one, without branches, the tick does it for every cell
+static inline enum cell_food_source cells_food_source(const struct cell_counters *counters)
+{
+	const unsigned photosynthesis = counters->photosynthesisCount, attack = counters->attackCount, eating = counters->eatingDeadCount;
+	const unsigned notPhotosynthesis = (photosynthesis < attack) | (photosynthesis < eating);
 
-		consumedEnergy += MOVEMENT_COST;
+	// FOOD_SOURCE_PHOTOSYNTHESIS, FOOD_SOURCE_MEAT or FOOD_SOURCE_DEAD_CELLS
+	return notPhotosynthesis * (1 + (attack < eating));
+}
 
-		break;
+// scaling by a power of two is exact, float is enough
+static inline long long cells_energy_units(const float energy)
+{
+	return (long long)(energy * (float)CELLS_ENERGY_SCALE);
+}
 
-	case PHOTOSYNTHESIS:
-		if (cell.attackCount > cell.photosynthesisCount)
-			consumedEnergy -= PHOTOSYNTHESIS_ENERGY / 2;
-		else
-			consumedEnergy -= PHOTOSYNTHESIS_ENERGY;
+static inline unsigned cells_age_bucket(const struct cells_state *state, const unsigned age)
+{
+	const unsigned bucket = age >> state->ageShift;
 
-		cell.photosynthesisCount++;
+	return bucket < CELLS_AGE_BUCKETS ? bucket : CELLS_AGE_BUCKETS - 1;
+}
 
-		break;
+// adds ( sign 1 ) or subtracts ( sign -1 ) part of the slot in the statistics
+static inline void cells_stats_slot(struct cells_stats *stats, const struct cells_state *state, const size_t index, const long long sign)
+{
+	if (state->empty[index])
+		stats->empty += sign;
+	else if (!state->alive[index])
+	{
+		stats->dead += sign;
+		stats->deadEnergy += sign * cells_energy_units(state->energy[index]);
+	}
+	else
+	{
+		stats->alive += sign;
+		stats->aliveEnergy += sign * cells_energy_units(state->energy[index]);
+		stats->foodSources[cells_food_source(&state->counters[index])] += sign;
+		stats->ages[cells_age_bucket(state, state->age[index])] += sign;
+	}
+}
 
-	case GIVE_ENERGY:
-		frontCell = cells_get_cell(state, facingX, facingY);
+// energy of an alive cell changed from given one
+static inline void cells_stats_energy(struct cells_stats *stats, const struct cells_state *state, const size_t index, const float energy)
+{
+	stats->aliveEnergy += cells_energy_units(state->energy[index]) - cells_energy_units(energy);
+}
 
-		if (!frontCell->alive || frontCell->empty)
-			break;
+// the cell stayed alive through its update, energy is what it had before, age is about to grow
+static inline void cells_stats_live(struct cells_stats *stats, const struct cells_state *state, const size_t index, const float energy)
+{
+	cells_stats_energy(stats, state, index, energy);
 
-		float energyToGive = currentInstruction.e;
-		if (energyToGive > cell.energy)
-			energyToGive = cell.energy;
+	// the age range changes once in many ticks, that's predictable, unlike moving cells between ranges every time
+	const unsigned bucket = cells_age_bucket(state, state->age[index]), nextBucket = cells_age_bucket(state, state->age[index] + 1);
+	if (bucket != nextBucket)
+	{
+		stats->ages[bucket]--;
+		stats->ages[nextBucket]++;
+	}
+}
 
-		frontCell->energy += energyToGive;
-		consumedEnergy += energyToGive;
+// the cell died, energy is what it had, when it was counted as alive the last time
+static inline void cells_stats_death(struct cells_stats *stats, const struct cells_state *state, const size_t index, const float energy)
+{
+	stats->alive--;
+	stats->aliveEnergy -= cells_energy_units(energy);
+	stats->foodSources[cells_food_source(&state->counters[index])]--;
+	stats->ages[cells_age_bucket(state, state->age[index])]--;
+
+	stats->dead++;
+	stats->deadEnergy += cells_energy_units(state->energy[index]);
+	stats->deaths++;
+}
 
-		break;
+// adds changes made by a tile, tiles of one phase finish in any order
+static void cells_stats_merge(struct cells_stats *stats, const struct cells_stats *changes)
+{
+	long long *to = (long long *)stats;
+	const long long *from = (const long long *)changes;
 
-	case ATTACK_CELL:
-		if (cell.energy < ATTACK_REQUIRED_ENERGY)
-		{
-			break;
-		}
+	for (size_t i = 0; i < sizeof(struct cells_stats) / sizeof(long long); i++)
+	{
+		if (from[i])
+			__atomic_fetch_add(&to[i], from[i], __ATOMIC_RELAXED);
+	}
+}
 
-		cell.energy -= ATTACK_REQUIRED_ENERGY;
+// returns number of the first genomeLength positions, where both opcode arrays have the same command
+static inline unsigned cells_count_equal_opcodes(const uint8_t *ours, const uint8_t *theirs, const unsigned genomeLength)
+{
+	unsigned equal = 0;
+	int i = 0;
 
-		frontCell = cells_get_cell(state, facingX, facingY);
+	// padding past the genome length is zero in both, so all of it is compared and taken back
+#ifdef __SSE2__
+	for (; i + 16 <= GENOME_MAX_LENGTH; i += 16)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i *)(ours + i));
+		const __m128i b = _mm_loadu_si128((const __m128i *)(theirs + i));
 
-		if (!frontCell->alive)
-			break;
+		equal += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+	}
+#endif
 
-		float takenEnergy;
+	for (; i < GENOME_MAX_LENGTH; i++)
+		equal += ours[i] == theirs[i];
 
-		enum cell_food_source food_source = cells_get_cell_food_source(cell);
+	return equal - (GENOME_MAX_LENGTH - genomeLength);
+}
 
-		if (food_source == FOOD_SOURCE_MEAT)
-		{
-			// if option is true, kill the cell in fromt
-			if (currentInstruction.opt)
-			{
-				cell.energy -= ATTACK_REQUIRED_ENERGY;
-				takenEnergy = frontCell->energy * ATTACK_ENERGY;
-				frontCell->alive = false;
-				// cells_set_cell(state, facingX, facingY, cells_generate_empty_cell(facingX, facingY));
-			}
-			else
-				takenEnergy = frontCell->energy * ATTACK_ENERGY;
-		}
-		else
-			takenEnergy = frontCell->energy * (ATTACK_ENERGY / 2.f);
+// remembers that cell which just moved or was born to given slot shouldn't act again this tick
+static inline void cells_set_acted(struct cells_state *state, const size_t index)
+{
+	if (state->tickMode == TICK_ONCE)
+		__atomic_fetch_or(&state->actedBits[index / 64], 1ull << (index % 64), __ATOMIC_RELAXED);
+}
 
-		frontCell->energy -= takenEnergy * 1.5f;
-		cell.energy += takenEnergy;
+// moves cell between two slots, leaving empty space behind
+static void cells_move_cell(struct cells_state *state, const size_t from, const size_t to)
+{
+	cells_set_alive(state, to, state->alive[from]);
+	state->empty[to] = state->empty[from];
+	state->energy[to] = state->energy[from];
+	state->direction[to] = state->direction[from];
+	state->currentInstruction[to] = state->currentInstruction[from];
+	state->age[to] = state->age[from];
+
+	// the genome reference moves along, slot "to" was empty and held none
+	state->genomes[to] = state->genomes[from];
+	state->genomes[from] = GENOME_NONE;
+	state->lineages[to] = state->lineages[from];
+	state->lineages[from] = LINEAGE_NONE;
+
+	state->colors[to] = state->colors[from];
+	state->counters[to] = state->counters[from];
+
+	cells_empty_slot(state, from);
+	cells_set_acted(state, to);
+}
 
-		cell.attackCount++;
+/*
+	The cell VM.
+	Every opcode has its own handler, cells_update_cell() jumps straight to
+	it through a computed goto table. Handlers get the running cell in
+	struct cells_vm, the facing cell is only looked up for opcodes which
+	use it ( see cells_opcode_facing[] ).
+*/
+struct cells_vm
+{
+	struct cells_state *state;
+	struct cells_context *context;
+
+	size_t index;
+	// valid only if the opcode has facing set
+	size_t front;
+
+	packed_instruction instruction;
+	unsigned nextInstruction;
+	float consumedEnergy;
+	// a jump went to b1, only read with CELLS_PROFILE
+	bool taken;
+};
+
+// returns offset of the cell in front of given one, the world wraps around
+static inline size_t cells_facing(const struct cells_state *state, const unsigned x, const unsigned y, const enum direction direction)
+{
+	unsigned facingX = x, facingY = y;
 
+	switch (direction)
+	{
+	case LEFT:
+		facingX = x == 0 ? state->width - 1 : x - 1;
 		break;
-
-	case RECYCLE_DEAD_CELL:
-		frontCell = cells_get_cell(state, facingX, facingY);
-
-		if (frontCell->empty || frontCell->alive)
-			break;
-
-		cells_set_cell(state, facingX, facingY, cells_generate_empty_cell(facingX, facingY));
-		consumedEnergy -= frontCell->energy;
-		cell.eatingDeadCount++;
-
+	case RIGHT:
+		facingX = x + 1 == state->width ? 0 : x + 1;
 		break;
-
-	case CHECK_ENERGY:
-		if (cell.energy > currentInstruction.e)
-			nextInstruction = currentInstruction.b1;
-		else
-			nextInstruction = currentInstruction.b2;
-
+	case UP:
+		facingY = y == 0 ? state->height - 1 : y - 1;
 		break;
+	case DOWN:
+		facingY = y + 1 == state->height ? 0 : y + 1;
+		break;
+	}
 
-	case CHECK_ROTATION:
-		switch (cell.direction)
-		{
-		case LEFT:
-			nextInstruction = currentInstruction.b1;
-		case RIGHT:
-			nextInstruction = currentInstruction.b2;
-		case UP:
-			nextInstruction = currentInstruction.b3;
-		case DOWN:
-			nextInstruction = currentInstruction.b4;
-		}
+	return cells_index(state, facingX, facingY);
+}
 
-		break;
+// counts energy the cell got from a source, which may change its food source
+static inline void cells_feed(struct cells_vm *vm, unsigned *count)
+{
+	struct cells_stats *stats = &vm->context->stats;
+	const struct cell_counters *counters = &vm->state->counters[vm->index];
+	const enum cell_food_source source = cells_food_source(counters);
 
-	case JMP_IF_FACING_ALIVE_CELL:
-		if (cells_get_cell(state, facingX, facingY)->alive)
-			nextInstruction = currentInstruction.b1;
-		else
-			nextInstruction = currentInstruction.b2;
+	(*count)++;
 
-		break;
+	const enum cell_food_source newSource = cells_food_source(counters);
+	if (newSource != source)
+	{
+		stats->foodSources[source]--;
+		stats->foodSources[newSource]++;
+	}
+}
 
-	case JMP_IF_FACING_VOID:
-		if (cells_get_cell(state, facingX, facingY)->empty)
-			nextInstruction = currentInstruction.b1;
-		else
-			nextInstruction = currentInstruction.b2;
+static inline void cells_op_noop(struct cells_vm *vm)
+{
+}
 
-		break;
+static inline void cells_op_turn_left(struct cells_vm *vm)
+{
+	uint8_t *direction = &vm->state->direction[vm->index];
 
-	case JMP_IF_FACING_DEAD_CELL:
-		if (!cells_get_cell(state, facingX, facingY)->alive && !cells_get_cell(state, facingX, facingY)->empty)
-			nextInstruction = currentInstruction.b1;
-		else
-			nextInstruction = currentInstruction.b2;
+	*direction = *direction == LEFT ? DOWN : *direction - 1;
+	vm->consumedEnergy += vm->state->params.turnCost;
+}
 
-		break;
+static inline void cells_op_turn_right(struct cells_vm *vm)
+{
+	uint8_t *direction = &vm->state->direction[vm->index];
 
-	case JMP_IF_FACING_RELATIVE:
-	{
-		// checking genome similarity
-		unsigned similarGenes = 0;
+	*direction = *direction == DOWN ? LEFT : *direction + 1;
+	vm->consumedEnergy += vm->state->params.turnCost;
+}
 
-		struct instruction *ours = cell.genome;
-		struct instruction *theirs = cells_get_cell(state, facingX, facingY)->genome;
+static inline void cells_op_move_forwards(struct cells_vm *vm)
+{
+	// cell moves only into empty space
+	if (vm->state->empty[vm->front])
+	{
+		cells_move_cell(vm->state, vm->index, vm->front);
 
-		for (int i = 0; i < GENOME_LENGTH; i++)
-		{
+		// the rest of the update applies to the moved cell
+		vm->index = vm->front;
+	}
 
-			if (ours[i].command == theirs[i].command)
-				similarGenes++;
-		}
+	vm->consumedEnergy += vm->state->params.moveCost;
+}
 
-		// If at least GENOME_LENGTH-1 genes the same, treat cells as relatives
-		if (similarGenes >= GENOME_LENGTH - 1)
-			nextInstruction = currentInstruction.b1;
-		else
-			nextInstruction = currentInstruction.b2;
+static inline void cells_op_photosynthesis(struct cells_vm *vm)
+{
+	struct cell_counters *counters = &vm->state->counters[vm->index];
+	const unsigned energy = vm->state->params.photosynthesisEnergy;
 
-		break;
-	}
+	if (counters->attackCount > counters->photosynthesisCount)
+		vm->consumedEnergy -= energy / 2;
+	else
+		vm->consumedEnergy -= energy;
 
-	case MAKE_CHILD:
-		// skipping instruction, if cell doesn't have enough energy
-		if (cell.energy < REPRODUCTION_REQUIRED_ENERGY)
-			break;
+	cells_feed(vm, &counters->photosynthesisCount);
+}
 
-		if (!cells_get_cell(state, facingX, facingY)->empty)
-			break;
+static inline void cells_op_give_energy(struct cells_vm *vm)
+{
+	struct cells_state *state = vm->state;
 
-		struct cell child = {};
+	if (!state->alive[vm->front] || state->empty[vm->front])
+		return;
 
-		child.alive = true;
-		child.empty = false;
+	float energyToGive = genome_e(vm->instruction);
+	if (energyToGive > state->energy[vm->index])
+		energyToGive = state->energy[vm->index];
 
-		child.x = facingX;
-		child.y = facingY;
+	const float energy = state->energy[vm->front];
+	state->energy[vm->front] += energyToGive;
+	vm->consumedEnergy += energyToGive;
 
-		child.age = 1;
+	// the cell itself is counted, when its update is done
+	if (vm->front != vm->index)
+		cells_stats_energy(&vm->context->stats, state, vm->front, energy);
+}
 
-		child.direction = util_random(0, 3);
+static inline void cells_op_attack_cell(struct cells_vm *vm)
+{
+	struct cells_state *state = vm->state;
+	const size_t index = vm->index, front = vm->front;
+	const float cost = state->params.attackCost, fraction = state->params.attackEnergy;
 
-		child.r = cell.r, child.g = cell.g, child.b = cell.b;
+	if (state->energy[index] < cost)
+		return;
 
-		child.energy = START_ENERGY;
+	state->energy[index] -= cost;
 
-		// printf("Child energy %f; New parent energy %f\n", child.energy, cell.energy);
+	if (!state->alive[front])
+		return;
 
-		memcpy(child.genome, cell.genome, sizeof(child.genome));
+	const float energy = state->energy[front];
+	float takenEnergy;
 
-		// mutation can happen
-		if (util_random(1, 100) <= MUTATION_PERCENT)
+	if (cells_get_cell_food_source(state, index) == FOOD_SOURCE_MEAT)
+	{
+		// if option is true, kill the cell in front
+		if (genome_opt(vm->instruction))
 		{
-			unsigned geneToMutate = util_random(0, GENOME_LENGTH - 1);
-
-			child.genome[geneToMutate].command = util_random(0, MAKE_CHILD);
-			child.genome[geneToMutate].opt = rand() > (RAND_MAX / 2);
-			child.genome[geneToMutate].e += util_random(-3, 3);
-			child.genome[geneToMutate].b1 += util_random(-2, 2);
-			child.genome[geneToMutate].b2 += util_random(-2, 2);
-			child.genome[geneToMutate].b3 += util_random(-2, 2);
-			child.genome[geneToMutate].b4 += util_random(-2, 2);
-
-			child.genome[geneToMutate].e = util_clamp(child.genome[geneToMutate].e, 0, REPRODUCTION_REQUIRED_ENERGY);
-			child.genome[geneToMutate].b1 = util_clamp(child.genome[geneToMutate].e, 0, GENOME_LENGTH - 1);
-			child.genome[geneToMutate].b2 = util_clamp(child.genome[geneToMutate].e, 0, GENOME_LENGTH - 1);
-			child.genome[geneToMutate].b3 = util_clamp(child.genome[geneToMutate].e, 0, GENOME_LENGTH - 1);
-			child.genome[geneToMutate].b4 = util_clamp(child.genome[geneToMutate].e, 0, GENOME_LENGTH - 1);
-
-			// changing child's color a bit
-			unsigned colorToChange = util_random(0, 2);
-
-			if (colorToChange == 0)
-				child.r += util_random(-16, 16);
-			if (colorToChange == 1)
-				child.g += util_random(-16, 16);
-			if (colorToChange == 2)
-				child.b += util_random(-16, 16);
+			state->energy[index] -= cost;
+			takenEnergy = state->energy[front] * fraction;
+			cells_set_alive(state, front, false);
 		}
+		else
+			takenEnergy = state->energy[front] * fraction;
+	}
+	else
+		takenEnergy = state->energy[front] * (fraction / 2.f);
 
-		child.r = util_clamp(child.r, 0, 255);
-		child.g = util_clamp(child.g, 0, 255);
-		child.b = util_clamp(child.b, 0, 255);
+	state->energy[front] -= takenEnergy * 1.5f;
+	state->energy[index] += takenEnergy;
 
-		// if there's dead cell at child's position, child gets it's energy
-		if (!cells_get_cell(state, facingX, facingY)->alive && !cells_get_cell(state, facingX, facingY)->empty)
+	// the cell itself is counted, when its update is done
+	if (front != index)
+	{
+		if (state->alive[front])
+			cells_stats_energy(&vm->context->stats, state, front, energy);
+		else
 		{
-			child.energy += cells_get_cell(state, facingX, facingY)->energy;
+			cells_stats_death(&vm->context->stats, state, front, energy);
+			cells_lineage_death(state, vm->context->lineage, front);
 		}
+	}
 
-		cells_set_cell(state, facingX, facingY, child);
+	cells_feed(vm, &state->counters[index].attackCount);
+}
 
-		break;
+static inline void cells_op_recycle_dead_cell(struct cells_vm *vm)
+{
+	struct cells_state *state = vm->state;
 
-	default:
-		break;
-	}
+	if (state->empty[vm->front] || state->alive[vm->front])
+		return;
+
+	vm->consumedEnergy -= state->energy[vm->front];
 
-	if (nextInstruction >= GENOME_LENGTH)
-		nextInstruction %= GENOME_LENGTH;
-	cell.currentInstruction = nextInstruction;
+	cells_stats_slot(&vm->context->stats, state, vm->front, -1);
+	cells_empty_slot(state, vm->front);
+	cells_stats_slot(&vm->context->stats, state, vm->front, 1);
 
-	cell.energy -= consumedEnergy;
+	cells_feed(vm, &state->counters[vm->index].eatingDeadCount);
+}
+
+// jumps to b1 if condition holds, to b2 otherwise
+static inline void cells_branch(struct cells_vm *vm, const bool condition)
+{
+	vm->nextInstruction = condition ? genome_b1(vm->instruction) : genome_b2(vm->instruction);
+	vm->taken = condition;
+}
+
+static inline void cells_op_check_energy(struct cells_vm *vm)
+{
+	cells_branch(vm, vm->state->energy[vm->index] > genome_e(vm->instruction));
+}
+
+static inline void cells_op_check_rotation(struct cells_vm *vm)
+{
+	// the switch this replaced fell through every direction, so cells
+	// always ended up at b4. Evolved genomes rely on it, so it's kept
+	vm->nextInstruction = genome_b4(vm->instruction);
+	vm->taken = true;
+}
+
+static inline void cells_op_jmp_if_facing_alive_cell(struct cells_vm *vm)
+{
+	cells_branch(vm, vm->state->alive[vm->front]);
+}
+
+static inline void cells_op_jmp_if_facing_dead_cell(struct cells_vm *vm)
+{
+	cells_branch(vm, !vm->state->alive[vm->front] && !vm->state->empty[vm->front]);
+}
 
-	if (cell.age > CELL_MAX_AGE || cell.energy < 0)
+static inline void cells_op_jmp_if_facing_void(struct cells_vm *vm)
+{
+	cells_branch(vm, vm->state->empty[vm->front]);
+}
+
+static inline void cells_op_jmp_if_facing_relative(struct cells_vm *vm, const unsigned genomeLength)
+{
+	const struct cells_state *state = vm->state;
+	const genome_handle ours = state->genomes[vm->index], theirs = state->genomes[vm->front];
+
+	// clones are common, genomes are interned, so same handle means same genome
+	if (ours == theirs)
 	{
-		cell.alive = false;
+		cells_branch(vm, genomeLength >= state->relativeThreshold);
+		return;
 	}
 
-	cell.age++;
+	const unsigned similarGenes = cells_count_equal_opcodes(genome_pool_get(state->genomePool, ours)->opcodes,
+															genome_pool_get(state->genomePool, theirs)->opcodes, genomeLength);
 
-	cells_set_cell(state, cell.x, cell.y, cell);
+	cells_branch(vm, similarGenes >= state->relativeThreshold);
 }
 
-struct cells_state *cells_init()
+static inline void cells_op_make_child(struct cells_vm *vm, const unsigned genomeLength)
 {
-	struct cells_state *state = calloc(1, sizeof(struct cells_state));
-	assert(state);
+	struct cells_state *state = vm->state;
+	const struct cells_params *params = &state->params;
+	const size_t index = vm->index, front = vm->front;
+
+	// skipping instruction, if cell doesn't have enough energy
+	if (state->energy[index] < params->reproductionEnergy)
+		return;
+
+	if (!state->empty[front])
+		return;
+
+	// child is built right in the free slot in front
+	struct util_rng rng = util_rng_init(vm->context->key, index);
+
+	vm->context->stats.births++;
+	cells_stats_slot(&vm->context->stats, state, front, -1);
+
+	state->currentInstruction[front] = 0;
+	cells_set_alive(state, front, true);
+	cells_set_acted(state, front);
+	state->empty[front] = false;
+	state->age[front] = 1;
+	state->direction[front] = util_rng_range(&rng, 0, 3);
+	state->energy[front] = params->startEnergy;
+
+	state->counters[front] = (struct cell_counters){0};
 
-	state->width = SIMULATION_HEIGHT;
-	state->height = SIMULATION_HEIGHT;
+	struct cell_color color = state->colors[index];
 
-	// fill the map with cells
-	for (int i = 0; i < SIMULATION_WIDTH; i++)
+	// mutation can happen, otherwise the child shares parent's genome
+	if (util_rng_range(&rng, 1, 100) <= (int)params->mutationPercent)
 	{
-		for (int j = 0; j < SIMULATION_HEIGHT; j++)
-		{
+		packed_instruction childGenome[GENOME_MAX_LENGTH];
+		memcpy(childGenome, cells_genome(state, index), sizeof(childGenome));
+
+		packed_instruction *packed = &childGenome[util_rng_range(&rng, 0, (int)genomeLength - 1)];
+		struct instruction unpacked = genome_unpack(*packed), *gene = &unpacked;
+
+		gene->command = util_rng_range(&rng, 0, MAKE_CHILD);
+		gene->opt = util_rng_bool(&rng);
+		gene->e += util_rng_range(&rng, -3, 3);
+		gene->b1 += util_rng_range(&rng, -2, 2);
+		gene->b2 += util_rng_range(&rng, -2, 2);
+		gene->b3 += util_rng_range(&rng, -2, 2);
+		gene->b4 += util_rng_range(&rng, -2, 2);
+
+		gene->e = util_clamp(gene->e, 0, (int)params->reproductionEnergy);
+		gene->b1 = util_clamp(gene->e, 0, (int)genomeLength - 1);
+		gene->b2 = util_clamp(gene->e, 0, (int)genomeLength - 1);
+		gene->b3 = util_clamp(gene->e, 0, (int)genomeLength - 1);
+		gene->b4 = util_clamp(gene->e, 0, (int)genomeLength - 1);
+
+		*packed = genome_pack(gene);
+		state->genomes[front] = genome_pool_intern(state->genomePool, childGenome);
+
+		// a mutant starts its own lineage, the id comes when the tick is done
+		state->lineages[front] = lineage_pool_mint(state->lineagePool, state->lineages[index], 0);
+		cells_lineage_birth(vm->context->lineage, state->lineages[front]);
+
+		// changing child's color a bit
+		unsigned colorToChange = util_rng_range(&rng, 0, 2);
+
+		if (colorToChange == 0)
+			color.r += util_rng_range(&rng, -16, 16);
+		if (colorToChange == 1)
+			color.g += util_rng_range(&rng, -16, 16);
+		if (colorToChange == 2)
+			color.b += util_rng_range(&rng, -16, 16);
+	}
+	else
+	{
+		genome_pool_retain(state->genomePool, state->genomes[index]);
+		state->genomes[front] = state->genomes[index];
 
-			// every 5th pixel has a cell in it
-			if (util_random(1, 5) == 1)
-				cells_set_cell(state, i, j, cells_generate_cell(i, j));
-			else
-				cells_set_cell(state, i, j, cells_generate_empty_cell(i, j));
-		}
+		lineage_pool_retain(state->lineagePool, state->lineages[index]);
+		lineage_pool_born(state->lineagePool, state->lineages[index]);
+		state->lineages[front] = state->lineages[index];
 	}
 
-	return state;
+	color.r = util_clamp(color.r, 0, 255);
+	color.g = util_clamp(color.g, 0, 255);
+	color.b = util_clamp(color.b, 0, 255);
+	state->colors[front] = color;
+	cells_stats_slot(&vm->context->stats, state, front, 1);
 }
 
-void cells_quit(struct cells_state *state)
+// opcodes, which look at the cell in front
+static const bool cells_opcode_facing[] = {
+	[MOVE_FORWARDS] = true,
+	[GIVE_ENERGY] = true,
+	[ATTACK_CELL] = true,
+	[RECYCLE_DEAD_CELL] = true,
+	[JMP_IF_FACING_ALIVE_CELL] = true,
+	[JMP_IF_FACING_DEAD_CELL] = true,
+	[JMP_IF_FACING_VOID] = true,
+	[JMP_IF_FACING_RELATIVE] = true,
+	[MAKE_CHILD] = true,
+};
+
+/*
+	Kernels updating one cell, common genome lengths have their own, which
+	take the next instruction modulo a constant, without a division.
+*/
+#define CELLS_KERNEL cells_update_cell_32
+#define CELLS_KERNEL_LENGTH 32
+#include "cells_kernel.h"
+
+#define CELLS_KERNEL cells_update_cell_16
+#define CELLS_KERNEL_LENGTH 16
+#include "cells_kernel.h"
+
+#define CELLS_KERNEL cells_update_cell_any
+#define CELLS_KERNEL_LENGTH state->params.genomeLength
+#include "cells_kernel.h"
+
+void cells_update_cell(struct cells_state *state, struct cells_context *context, const unsigned x, const unsigned y)
 {
-	free(state);
+	cells_update_cell_any(state, context, x, y);
+}
 
-	state = NULL;
+/*
+	Returns number of tiles along a side of given size.
+	Count has to be even, so the checkerboard phases stay apart across the
+	world edge, and tiles have to be at least two cells wide.
+*/
+static unsigned cells_tile_count(const unsigned size)
+{
+	unsigned count = size / TILE_SIZE;
+
+	if (count < 2)
+		return size >= 4 ? 2 : 1;
+
+	return count - count % 2;
 }
 
-void cells_update_state(struct cells_state *state)
+// splits the world into tiles, sorted by phase
+static void cells_split_tiles(struct cells_state *state)
 {
-	for (int i = 0; i < state->width; i++)
+	const unsigned columns = cells_tile_count(state->width);
+	const unsigned rows = cells_tile_count(state->height);
+
+	state->tileCount = columns * rows;
+	state->tiles = calloc(state->tileCount, sizeof(struct cells_tile));
+	assert(state->tiles);
+
+	unsigned n = 0;
+	for (unsigned p = 0; p < 4; p++)
 	{
-		for (int j = 0; j < state->height; j++)
+		state->phases[p] = n;
+
+		for (unsigned row = p / 2; row < rows; row += 2)
 		{
-			cells_update_cell(state, state->cells[i][j]);
+			for (unsigned column = p % 2; column < columns; column += 2)
+			{
+				state->tiles[n++] = (struct cells_tile){
+					.x0 = state->width * column / columns,
+					.y0 = state->height * row / rows,
+					.x1 = state->width * (column + 1) / columns,
+					.y1 = state->height * (row + 1) / rows,
+				};
+			}
 		}
 	}
+	state->phases[4] = n;
+
+	assert(n == state->tileCount);
 }
 
-struct cell *cells_get_cell(struct cells_state *state, const unsigned x, const unsigned y)
+/*
+	Room the lineage pool starts with: every cell may hold its own
+	lineage and a clone may still hold the ones of all cells it was taken
+	from. Lineages born and gone within a tick wait for it to end, the
+	pool grows for them if it has to.
+*/
+static uint32_t cells_lineage_capacity(const size_t size)
 {
-	if (x >= state->width || y >= state->height)
-		return NULL;
-
-	return &state->cells[x][y];
+	return size < UINT32_MAX / 2 ? 2 * size + 1 : UINT32_MAX - 1;
 }
 
-void cells_set_cell(struct cells_state *state, const unsigned x, const unsigned y, const struct cell cell)
+/*
+	Room the genome pool starts with: every cell may carry its own genome
+	and a clone saved in the background may still hold the ones of all
+	cells it was taken from. cells_set_cell() interns the new genome
+	before it drops the old one, the pool grows for it if it has to.
+*/
+static uint32_t cells_genome_capacity(const size_t size)
 {
-	if (x >= state->width || y >= state->height)
-		return;
+	return size < UINT32_MAX / 2 ? 2 * size + 1 : UINT32_MAX - 1;
+}
 
-	state->cells[x][y] = cell;
+// allocates lineage events of the tiles, the handles and the pool are made by the caller
+static void cells_init_lineage_events(struct cells_state *state)
+{
+	state->lineageEvents = calloc(state->tileCount, sizeof(*state->lineageEvents));
+	assert(state->lineageEvents);
 }
 
-unsigned cells_count_alive_cells(struct cells_state *state)
+static void cells_free_lineage_events(struct cells_lineage_events *events)
 {
-	unsigned count = 0;
+	free(events->births);
+	free(events->extinctions);
+}
 
-	for (int i = 0; i < state->width; i++)
-	{
-		for (int j = 0; j < state->height; j++)
-		{
-			if (cells_get_cell(state, i, j)->alive)
-				count++;
-		}
-	}
+// stats have to be recounted afterwards, age ranges follow the maximum age
+static void cells_apply_params(struct cells_state *state, const struct cells_params *params)
+{
+	state->params = *params;
+	state->ageShift = 0;
 
-	return count;
+	while (2u << state->ageShift <= params->maxAge / CELLS_AGE_BUCKETS)
+		state->ageShift++;
 }
 
-enum cell_food_source cells_get_cell_food_source(struct cell cell)
+struct cells_state *cells_init(const unsigned width, const unsigned height, const uint64_t seed, const struct cells_params *params,
+							   const unsigned density)
 {
-	float max = util_max(3, (float[]){cell.photosynthesisCount, cell.attackCount, cell.eatingDeadCount});
+	assert(width > 0 && height > 0);
+	assert(params && cells_check_params(params));
 
-	if (max == cell.photosynthesisCount)
+	const size_t size = (size_t)width * height;
+	assert(size < UINT32_MAX);
+
+	struct cells_state *state = calloc(1, sizeof(struct cells_state));
+	assert(state);
+
+	state->width = width;
+	state->height = height;
+
+	state->alive = calloc(size, sizeof(*state->alive));
+	state->aliveBits = calloc((size + 63) / 64, sizeof(*state->aliveBits));
+	state->empty = calloc(size, sizeof(*state->empty));
+	state->energy = calloc(size, sizeof(*state->energy));
+	state->direction = calloc(size, sizeof(*state->direction));
+	state->currentInstruction = calloc(size, sizeof(*state->currentInstruction));
+	state->age = calloc(size, sizeof(*state->age));
+	state->actedBits = calloc((size + 63) / 64, sizeof(*state->actedBits));
+	state->genomes = calloc(size, sizeof(*state->genomes));
+	state->genomePool = genome_pool_create(cells_genome_capacity(size));
+	state->lineages = calloc(size, sizeof(*state->lineages));
+	state->colors = calloc(size, sizeof(*state->colors));
+	state->counters = calloc(size, sizeof(*state->counters));
+	state->spanVersions = calloc(cells_span_count(state), sizeof(*state->spanVersions));
+
+	assert(state->alive && state->aliveBits && state->empty && state->energy && state->direction && state->currentInstruction);
+	assert(state->age && state->actedBits && state->genomes && state->lineages);
+	assert(state->colors && state->counters && state->spanVersions);
+
+	// zeroed slots are dead cells without energy, until they're populated
+	state->stats.dead = size;
+
+	state->seed = seed;
+	state->relativeThreshold = params->genomeLength - 1;
+	cells_apply_params(state, params);
+	cells_split_tiles(state);
+
+	cells_init_lineage_events(state);
+	state->lineagePool = lineage_pool_create(cells_lineage_capacity(size));
+
+	cells_populate(state, density);
+
+	return state;
+}
+
+void cells_populate(struct cells_state *state, const unsigned density)
+{
+	for (unsigned j = 0; j < state->height; j++)
+	{
+		for (unsigned i = 0; i < state->width; i++)
+		{
+			struct util_rng rng = util_rng_init(cells_tick_key(state), cells_index(state, i, j));
+
+			if (util_rng_range(&rng, 1, 100) <= density)
+			{
+				struct cell cell = cells_generate_cell(&rng, &state->params, i, j);
+				cells_set_cell(state, i, j, &cell);
+			}
+			else
+				cells_clear_cell(state, cells_index(state, i, j));
+		}
+	}
+}
+
+// id the next lineage gets, a clone keeps the one it was taken with
+static uint64_t cells_next_lineage(const struct cells_state *state)
+{
+	return state->clone ? state->nextLineage : state->lineagePool->nextId;
+}
+
+// returns malloc'ed copy of the array
+static void *cells_duplicate(const void *array, const size_t size)
+{
+	void *copy = malloc(size);
+	assert(copy);
+
+	return memcpy(copy, array, size);
+}
+
+struct cells_state *cells_clone(const struct cells_state *state)
+{
+	const size_t size = (size_t)state->width * state->height;
+
+	struct cells_state *copy = calloc(1, sizeof(struct cells_state));
+	assert(copy);
+
+	copy->width = state->width;
+	copy->height = state->height;
+
+	copy->alive = cells_duplicate(state->alive, size * sizeof(*state->alive));
+	copy->aliveBits = cells_duplicate(state->aliveBits, (size + 63) / 64 * sizeof(*state->aliveBits));
+	copy->empty = cells_duplicate(state->empty, size * sizeof(*state->empty));
+	copy->energy = cells_duplicate(state->energy, size * sizeof(*state->energy));
+	copy->direction = cells_duplicate(state->direction, size * sizeof(*state->direction));
+	copy->currentInstruction = cells_duplicate(state->currentInstruction, size * sizeof(*state->currentInstruction));
+	copy->age = cells_duplicate(state->age, size * sizeof(*state->age));
+	copy->genomes = cells_duplicate(state->genomes, size * sizeof(*state->genomes));
+	copy->colors = cells_duplicate(state->colors, size * sizeof(*state->colors));
+	copy->counters = cells_duplicate(state->counters, size * sizeof(*state->counters));
+
+	copy->lineages = cells_duplicate(state->lineages, size * sizeof(*state->lineages));
+
+	// genomes are immutable, the copy only has to keep them alive, ids of lineages never change once they're logged
+	copy->genomePool = state->genomePool;
+	copy->lineagePool = state->lineagePool;
+	copy->clone = true;
+
+	pthread_mutex_lock(&copy->lineagePool->lock);
+	copy->nextLineage = state->clone ? state->nextLineage : copy->lineagePool->nextId;
+	pthread_mutex_unlock(&copy->lineagePool->lock);
+
+	for (size_t i = 0; i < size; i++)
+	{
+		genome_pool_retain(copy->genomePool, copy->genomes[i]);
+		lineage_pool_retain(copy->lineagePool, copy->lineages[i]);
+	}
+
+	copy->tick = state->tick;
+	copy->version = state->version;
+	copy->stats = state->stats;
+	copy->instructions = state->instructions;
+	copy->seed = state->seed;
+	copy->tickMode = state->tickMode;
+	copy->relativeThreshold = state->relativeThreshold;
+	copy->params = state->params;
+	copy->ageShift = state->ageShift;
+
+	return copy;
+}
+
+size_t cells_memory_usage(const struct cells_state *state)
+{
+	const size_t size = (size_t)state->width * state->height;
+
+	size_t bytes = sizeof(struct cells_state) + sizeof(struct cells_tile) * state->tileCount;
+
+	bytes += (size + 63) / 64 * sizeof(*state->aliveBits);
+	bytes += size * (sizeof(*state->alive) + sizeof(*state->empty) + sizeof(*state->energy) + sizeof(*state->direction));
+	bytes += (size + 63) / 64 * sizeof(*state->actedBits);
+	bytes += size * (sizeof(*state->currentInstruction) + sizeof(*state->age));
+	bytes += size * sizeof(*state->genomes) + genome_pool_memory_usage(state->genomePool);
+	bytes += size * sizeof(*state->lineages) + lineage_pool_memory_usage(state->lineagePool);
+	bytes += size * (sizeof(*state->colors) + sizeof(*state->counters));
+	bytes += cells_span_count(state) * sizeof(*state->spanVersions);
+
+	return bytes;
+}
+
+void cells_quit(struct cells_state *state)
+{
+	if (!state)
+		return;
+
+	if (state->clone)
+	{
+		for (size_t i = 0; i < (size_t)state->width * state->height; i++)
+		{
+			genome_pool_release(state->genomePool, state->genomes[i]);
+			lineage_pool_release(state->lineagePool, state->lineages[i]);
+		}
+	}
+	else
+	{
+		genome_pool_destroy(state->genomePool);
+		lineage_pool_destroy(state->lineagePool);
+	}
+
+	if (state->lineageEvents)
+	{
+		for (unsigned i = 0; i < state->tileCount; i++)
+			cells_free_lineage_events(&state->lineageEvents[i]);
+	}
+	cells_free_lineage_events(&state->lineageEdits);
+
+	if (state->mapping)
+		munmap(state->mapping, state->mappingSize);
+	else
+	{
+		free(state->alive);
+		free(state->aliveBits);
+		free(state->empty);
+		free(state->energy);
+		free(state->direction);
+		free(state->currentInstruction);
+		free(state->age);
+		free(state->genomes);
+		free(state->colors);
+		free(state->counters);
+		free(state->lineages);
+	}
+
+	free(state->lineageEvents);
+	free(state->actedBits);
+	free(state->spanVersions);
+	free(state->tiles);
+	pool_destroy(state->pool);
+	free(state);
+
+	state = NULL;
+}
+
+uint64_t cells_tick_key(const struct cells_state *state)
+{
+	return util_rng_key(state->seed, state->tick);
+}
+
+struct cells_phase
+{
+	struct cells_state *state;
+	unsigned firstTile;
+};
+
+typedef void (*cells_kernel)(struct cells_state *state, struct cells_context *context, const unsigned x, const unsigned y);
+
+// inlined into a tile function for every kernel, so cells are updated by direct calls
+static inline __attribute__((always_inline)) void cells_update_tile_with(void *ctx, const unsigned task, const cells_kernel kernel)
+{
+	const struct cells_phase *phase = ctx;
+	struct cells_state *state = phase->state;
+	const unsigned tile = phase->firstTile + task;
+	const struct cells_tile *bounds = &state->tiles[tile];
+
+	struct cells_context context = {.key = cells_tick_key(state), .lineage = &state->lineageEvents[tile]};
+	const bool once = state->tickMode == TICK_ONCE;
+
+	for (unsigned j = bounds->y0; j < bounds->y1; j++)
+	{
+		const size_t row = cells_index(state, 0, j);
+		const size_t end = row + bounds->x1;
+		size_t index = row + bounds->x0;
+
+		/*
+			Only alive cells do something, so jumping between set bits.
+			The word is re-read after every update, cells which were moved
+			or born further along the row are visited the same way as if
+			the whole row was walked. In TICK_ONCE mode they're masked out.
+		*/
+		while (index < end)
+		{
+			uint64_t word = __atomic_load_n(&state->aliveBits[index / 64], __ATOMIC_RELAXED);
+			word &= ~0ull << (index % 64);
+
+			if (once)
+				word &= ~__atomic_load_n(&state->actedBits[index / 64], __ATOMIC_RELAXED);
+
+			if (end - index / 64 * 64 < 64)
+				word &= (1ull << (end % 64)) - 1;
+
+			if (!word)
+			{
+				index = (index / 64 + 1) * 64;
+				continue;
+			}
+
+			index = index / 64 * 64 + __builtin_ctzll(word);
+			kernel(state, &context, index - row, j);
+			index++;
+		}
+	}
+
+	__atomic_fetch_add(&state->instructions, context.instructions, __ATOMIC_RELAXED);
+	cells_stats_merge(&state->stats, &context.stats);
+
+#ifdef CELLS_PROFILE
+	cells_profile_add(&state->profile, &context.profile);
+#endif
+}
+
+static void cells_update_tile_32(void *ctx, const unsigned task, const unsigned worker)
+{
+	cells_update_tile_with(ctx, task, cells_update_cell_32);
+}
+
+static void cells_update_tile_16(void *ctx, const unsigned task, const unsigned worker)
+{
+	cells_update_tile_with(ctx, task, cells_update_cell_16);
+}
+
+static void cells_update_tile_any(void *ctx, const unsigned task, const unsigned worker)
+{
+	cells_update_tile_with(ctx, task, cells_update_cell_any);
+}
+
+/*
+	Logs births and extinctions of lineages in the given lists as a block
+	of the current tick and empties the lists. Births get their ids in
+	list order, tiles are listed in the order they're processed, so ids
+	don't depend on the number of threads.
+*/
+static void cells_flush_lineages(struct cells_state *state, struct cells_lineage_events *events, const unsigned count)
+{
+	uint32_t births = 0, extinctions = 0;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		births += events[i].birthCount;
+		extinctions += events[i].extinctionCount;
+	}
+
+	if (!births && !extinctions)
+		return;
+
+	// lineages born in the tick may be gone already
+	uint64_t *parents = malloc(((size_t)births * 2 + extinctions) * sizeof(uint64_t));
+	uint64_t *extinct = parents + births;
+	assert(parents);
+
+	// without births extinctions count down from the next id
+	uint64_t firstId = state->lineagePool->nextId;
+	births = extinctions = 0;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		for (uint32_t j = 0; j < events[i].birthCount; j++)
+		{
+			const lineage_handle lineage = events[i].births[j];
+			const bool gone = lineage_pool_get(state->lineagePool, lineage)->alive == 0;
+			const uint64_t id = lineage_pool_settle(state->lineagePool, lineage, &parents[births]);
+
+			firstId = births ? firstId : id;
+			assert(id == firstId + births);
+			births++;
+
+			if (gone)
+				extinct[extinctions++] = id;
+		}
+
+		for (uint32_t j = 0; j < events[i].extinctionCount; j++)
+			extinct[extinctions++] = events[i].extinctions[j];
+
+		events[i].birthCount = events[i].extinctionCount = 0;
+	}
+
+	if (state->lineageLog)
+		lineage_log_write(state->lineageLog, state->tick, firstId, parents, births, extinct, extinctions);
+
+	free(parents);
+}
+
+void cells_update_state(struct cells_state *state)
+{
+	// edits since the last tick happened at the current one
+	cells_flush_lineages(state, &state->lineageEdits, 1);
+
+	state->tick++;
+	state->version++;
+
+#ifdef CELLS_PROFILE
+	memset(&state->profile, 0, sizeof(state->profile));
+#endif
+
+	if (state->tickMode == TICK_ONCE)
+		memset(state->actedBits, 0, ((size_t)state->width * state->height + 63) / 64 * sizeof(*state->actedBits));
+
+	// common genome lengths have their own kernels
+	const unsigned genomeLength = state->params.genomeLength;
+	const pool_task update = genomeLength == 32 ? cells_update_tile_32 : genomeLength == 16 ? cells_update_tile_16 : cells_update_tile_any;
+
+	for (unsigned p = 0; p < 4; p++)
+	{
+		struct cells_phase phase = {state, state->phases[p]};
+		const unsigned tiles = state->phases[p + 1] - state->phases[p];
+
+		if (state->pool)
+			pool_run(state->pool, update, &phase, tiles);
+		else
+			for (unsigned i = 0; i < tiles; i++)
+				update(&phase, i, 0);
+	}
+
+	cells_flush_lineages(state, state->lineageEvents, state->tileCount);
+}
+
+bool cells_parse_tick_mode(const char *name, enum cells_tick_mode *mode)
+{
+	if (strcmp(name, "in-place") == 0)
+		*mode = TICK_IN_PLACE;
+	else if (strcmp(name, "once") == 0)
+		*mode = TICK_ONCE;
+	else
+		return false;
+
+	return true;
+}
+
+void cells_set_threads(struct cells_state *state, const unsigned threads)
+{
+	pool_destroy(state->pool);
+	state->pool = threads > 1 ? pool_create(threads) : NULL;
+}
+
+// drops edits without logging them, pending lineages are settled quietly
+static void cells_discard_lineage_edits(struct cells_state *state)
+{
+	struct cells_lineage_events *edits = &state->lineageEdits;
+	uint64_t parent;
+
+	for (uint32_t i = 0; i < edits->birthCount; i++)
+		lineage_pool_settle(state->lineagePool, edits->births[i], &parent);
+
+	edits->birthCount = edits->extinctionCount = 0;
+}
+
+void cells_set_lineage_log(struct cells_state *state, struct lineage_log *log)
+{
+	state->lineageLog = log;
+}
+
+bool cells_get_cell(const struct cells_state *state, const unsigned x, const unsigned y, struct cell *cell)
+{
+	if (x >= state->width || y >= state->height || !cell)
+		return false;
+
+	const size_t index = cells_index(state, x, y);
+
+	for (int i = 0; i < GENOME_MAX_LENGTH; i++)
+		cell->genome[i] = genome_unpack(cells_genome(state, index)[i]);
+	cell->currentInstruction = state->currentInstruction[index];
+	cell->direction = state->direction[index];
+	cell->energy = state->energy[index];
+	cell->alive = state->alive[index];
+	cell->empty = state->empty[index];
+	cell->age = state->age[index];
+
+	cell->x = x, cell->y = y;
+
+	cell->r = state->colors[index].r;
+	cell->g = state->colors[index].g;
+	cell->b = state->colors[index].b;
+
+	cell->photosynthesisCount = state->counters[index].photosynthesisCount;
+	cell->attackCount = state->counters[index].attackCount;
+	cell->eatingDeadCount = state->counters[index].eatingDeadCount;
+
+	cell->lineage = lineage_pool_get(state->lineagePool, state->lineages[index])->id;
+
+	return true;
+}
+
+// returns lineage with given id for a non-empty slot, an alive cell without one starts a new lineage
+static lineage_handle cells_adopt_lineage(struct cells_state *state, const uint64_t id, const bool alive)
+{
+	struct lineage_pool *pool = state->lineagePool;
+
+	if (id)
+	{
+		const lineage_handle lineage = lineage_pool_intern(pool, id);
+
+		if (alive)
+			lineage_pool_born(pool, lineage);
+
+		return lineage;
+	}
+
+	if (!alive)
+		return LINEAGE_NONE;
+
+	// edits happen between ticks, so the id is given right away
+	const lineage_handle lineage = lineage_pool_mint(pool, LINEAGE_NONE, pool->nextId++);
+	cells_lineage_birth(&state->lineageEdits, lineage);
+
+	return lineage;
+}
+
+void cells_set_cell(struct cells_state *state, const unsigned x, const unsigned y, const struct cell *cell)
+{
+	if (x >= state->width || y >= state->height || !cell)
+		return;
+
+	const size_t index = cells_index(state, x, y);
+
+	state->version++;
+	cells_stats_slot(&state->stats, state, index, -1);
+
+	// instructions past the genome length are dropped, so they stay zero
+	packed_instruction packed[GENOME_MAX_LENGTH] = {0};
+
+	for (unsigned i = 0; i < state->params.genomeLength; i++)
+		packed[i] = genome_pack(&cell->genome[i]);
+
+	// empty slots never hold a genome, cells_move_cell() relies on it
+	const genome_handle genome = cell->empty ? GENOME_NONE : genome_pool_intern(state->genomePool, packed);
+	genome_pool_release(state->genomePool, state->genomes[index]);
+	state->genomes[index] = genome;
+
+	// the new cell is counted first, so putting a cell of the same lineage in place doesn't end it
+	const lineage_handle lineage = cell->empty ? LINEAGE_NONE : cells_adopt_lineage(state, cell->lineage, cell->alive);
+	if (state->alive[index])
+		cells_lineage_death(state, &state->lineageEdits, index);
+	lineage_pool_release(state->lineagePool, state->lineages[index]);
+	state->lineages[index] = lineage;
+
+	state->currentInstruction[index] = cell->currentInstruction % state->params.genomeLength;
+	state->direction[index] = cell->direction;
+	state->energy[index] = cell->energy;
+	// empty space is never alive, cells_map() refuses files with such cells
+	cells_set_alive(state, index, cell->alive && !cell->empty);
+	state->empty[index] = cell->empty;
+	state->age[index] = cell->age;
+
+	state->colors[index] = (struct cell_color){cell->r, cell->g, cell->b};
+	state->counters[index] = (struct cell_counters){cell->photosynthesisCount, cell->attackCount, cell->eatingDeadCount};
+
+	cells_stats_slot(&state->stats, state, index, 1);
+}
+
+void cells_clear_cell(struct cells_state *state, const size_t index)
+{
+	state->version++;
+
+	if (state->alive[index])
+		cells_lineage_death(state, &state->lineageEdits, index);
+
+	cells_stats_slot(&state->stats, state, index, -1);
+	cells_empty_slot(state, index);
+	cells_stats_slot(&state->stats, state, index, 1);
+}
+
+unsigned cells_count_alive_cells(const struct cells_state *state)
+{
+	return state->stats.alive;
+}
+
+#ifdef CELLS_PROFILE
+void cells_profile_add(struct cells_profile *total, const struct cells_profile *profile)
+{
+	// every field is a 64 bit counter, tiles of one phase add theirs at the same time
+	unsigned long long *to = (unsigned long long *)total;
+	const unsigned long long *from = (const unsigned long long *)profile;
+
+	for (size_t i = 0; i < sizeof(struct cells_profile) / sizeof(unsigned long long); i++)
+	{
+		if (from[i])
+			__atomic_fetch_add(&to[i], from[i], __ATOMIC_RELAXED);
+	}
+}
+
+static const char *cells_opcode_names[] = {
+	[NOOP] = "NOOP",
+	[TURN_LEFT] = "TURN_LEFT",
+	[TURN_RIGHT] = "TURN_RIGHT",
+	[MOVE_FORWARDS] = "MOVE_FORWARDS",
+	[PHOTOSYNTHESIS] = "PHOTOSYNTHESIS",
+	[GIVE_ENERGY] = "GIVE_ENERGY",
+	[ATTACK_CELL] = "ATTACK_CELL",
+	[RECYCLE_DEAD_CELL] = "RECYCLE_DEAD_CELL",
+	[CHECK_ENERGY] = "CHECK_ENERGY",
+	[CHECK_ROTATION] = "CHECK_ROTATION",
+	[JMP_IF_FACING_ALIVE_CELL] = "JMP_IF_FACING_ALIVE_CELL",
+	[JMP_IF_FACING_DEAD_CELL] = "JMP_IF_FACING_DEAD_CELL",
+	[JMP_IF_FACING_VOID] = "JMP_IF_FACING_VOID",
+	[JMP_IF_FACING_RELATIVE] = "JMP_IF_FACING_RELATIVE",
+	[MAKE_CHILD] = "MAKE_CHILD",
+};
+
+void cells_profile_report(FILE *f, const struct cells_profile *profile)
+{
+	unsigned long long executions = 0;
+
+	for (int i = 0; i <= MAKE_CHILD; i++)
+		executions += profile->opcodes[i].executions;
+
+	for (int i = 0; i <= MAKE_CHILD; i++)
+	{
+		const struct cells_opcode_profile *opcode = &profile->opcodes[i];
+
+		if (!opcode->executions)
+			continue;
+
+		// only CHECK_* and JMP_* jump
+		char taken[24] = "";
+		if (i >= CHECK_ENERGY && i <= JMP_IF_FACING_RELATIVE)
+			snprintf(taken, sizeof(taken), ", %5.1f%% taken", 100. * opcode->taken / opcode->executions);
+
+		fprintf(f, "[ profile %-24s ] %12llu executed ( %5.1f%% ), energy -%.1f +%.1f%s\n", cells_opcode_names[i], opcode->executions,
+				100. * opcode->executions / executions, (double)opcode->consumed / CELLS_ENERGY_SCALE,
+				(double)opcode->gained / CELLS_ENERGY_SCALE, taken);
+	}
+}
+#endif
+
+struct cells_stats cells_recount_stats(const struct cells_state *state)
+{
+	struct cells_stats stats = {0};
+
+	for (size_t i = 0; i < (size_t)state->width * state->height; i++)
+		cells_stats_slot(&stats, state, i, 1);
+
+	return stats;
+}
+
+enum cell_food_source cells_get_cell_food_source(const struct cells_state *state, const size_t index)
+{
+	return cells_food_source(&state->counters[index]);
+}
+
+#define CELLS_SNAPSHOT_MAGIC "CELLSNAP"
+// magic, 6 numbers of 4 bytes and 3 of 8 bytes, without the checksum
+#define CELLS_HEADER_SIZE_V1 (8 + 6 * 4 + 3 * 8)
+// version 2 adds 10 parameters of 4 bytes
+#define CELLS_HEADER_SIZE_V2 (CELLS_HEADER_SIZE_V1 + 10 * 4)
+// version 3 adds the next lineage id
+#define CELLS_HEADER_SIZE (CELLS_HEADER_SIZE_V2 + 8)
+// writer starts a new block, when the payload gets that big
+#define CELLS_BLOCK_SIZE (64 * 1024)
+// reader refuses bigger blocks as corrupted
+#define CELLS_MAX_BLOCK_SIZE (256 * 1024 * 1024)
+
+// growing byte array
+struct cells_buffer
+{
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static void cells_write_bytes(struct cells_buffer *buffer, const void *data, const size_t size)
+{
+	if (buffer->size + size > buffer->capacity)
+	{
+		buffer->capacity = (buffer->size + size) * 2;
+		buffer->data = realloc(buffer->data, buffer->capacity);
+		assert(buffer->data);
+	}
+
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+static void cells_write_u8(struct cells_buffer *buffer, const uint8_t value)
+{
+	cells_write_bytes(buffer, &value, 1);
+}
+
+static void cells_write_u32(struct cells_buffer *buffer, const uint32_t value)
+{
+	const uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+	cells_write_bytes(buffer, bytes, 4);
+}
+
+static void cells_write_u64(struct cells_buffer *buffer, const uint64_t value)
+{
+	cells_write_u32(buffer, value);
+	cells_write_u32(buffer, value >> 32);
+}
+
+static void cells_write_f32(struct cells_buffer *buffer, const float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	cells_write_u32(buffer, bits);
+}
+
+// 7 bits per byte, high bit is set on all bytes but the last
+static void cells_write_varint(struct cells_buffer *buffer, uint64_t value)
+{
+	for (; value >= 0x80; value >>= 7)
+		cells_write_u8(buffer, value | 0x80);
+
+	cells_write_u8(buffer, value);
+}
+
+// reads from a byte array, after the first overrun ok is false and everything reads as zero
+struct cells_cursor
+{
+	const uint8_t *data;
+	size_t size;
+	size_t offset;
+	bool ok;
+};
+
+static const uint8_t *cells_read_bytes(struct cells_cursor *cursor, const size_t size)
+{
+	if (!cursor->ok || cursor->size - cursor->offset < size)
+	{
+		cursor->ok = false;
+		return NULL;
+	}
+
+	const uint8_t *bytes = cursor->data + cursor->offset;
+	cursor->offset += size;
+
+	return bytes;
+}
+
+static uint8_t cells_read_u8(struct cells_cursor *cursor)
+{
+	const uint8_t *bytes = cells_read_bytes(cursor, 1);
+	return bytes ? bytes[0] : 0;
+}
+
+static uint32_t cells_read_u32(struct cells_cursor *cursor)
+{
+	const uint8_t *bytes = cells_read_bytes(cursor, 4);
+	return bytes ? bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24 : 0;
+}
+
+static uint64_t cells_read_u64(struct cells_cursor *cursor)
+{
+	const uint64_t low = cells_read_u32(cursor);
+	return low | (uint64_t)cells_read_u32(cursor) << 32;
+}
+
+static float cells_read_f32(struct cells_cursor *cursor)
+{
+	const uint32_t bits = cells_read_u32(cursor);
+	float value;
+	memcpy(&value, &bits, 4);
+
+	return value;
+}
+
+static uint64_t cells_read_varint(struct cells_cursor *cursor)
+{
+	uint64_t value = 0;
+
+	for (unsigned shift = 0; shift < 64; shift += 7)
+	{
+		const uint8_t byte = cells_read_u8(cursor);
+		value |= (uint64_t)(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return cursor->ok ? value : 0;
+	}
+
+	cursor->ok = false;
+	return 0;
+}
+
+// same, but straight from the file
+static bool cells_read_file_varint(FILE *f, uint64_t *value)
+{
+	*value = 0;
+
+	for (unsigned shift = 0; shift < 64; shift += 7)
+	{
+		const int byte = getc(f);
+		if (byte == EOF)
+			return false;
+
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+struct cells_writer
+{
+	FILE *f;
+	bool ok;
+	struct cells_snapshot_info info;
+	// cells taken so far
+	uint64_t cells;
+
+	// current block, pendingEmpty cells at its end aren't written yet
+	struct cells_buffer block;
+	uint64_t blockCells;
+	uint64_t pendingEmpty;
+
+	// genomes written so far, interned to find repeats
+	struct genome_pool *genomes;
+	// number of every written genome by its handle, 0 if not written yet
+	uint32_t *genomeIds;
+	uint32_t genomeCount;
+};
+
+struct cells_reader
+{
+	FILE *f;
+	bool ok;
+	uint32_t version;
+	struct cells_snapshot_info info;
+	// cells returned so far
+	uint64_t cells;
+
+	// current block
+	struct cells_buffer block;
+	struct cells_cursor cursor;
+	uint64_t blockCells;
+	// empty cells to return before the next non-empty one
+	uint64_t pendingEmpty;
+	bool pendingCell;
+
+	// genomes read so far, GENOME_MAX_LENGTH instructions each, padded with zeros
+	packed_instruction *genomes;
+	uint32_t genomeCount;
+	uint32_t genomeCapacity;
+};
+
+struct cells_snapshot_info cells_snapshot_info(const struct cells_state *state)
+{
+	return (struct cells_snapshot_info){
+		.width = state->width,
+		.height = state->height,
+		.seed = state->seed,
+		.tick = state->tick,
+		.instructions = state->instructions,
+		.tickMode = state->tickMode,
+		.relativeThreshold = state->relativeThreshold,
+		.params = state->params,
+		.nextLineage = cells_next_lineage(state),
+	};
+}
+
+struct cells_writer *cells_writer_open(FILE *f, const struct cells_snapshot_info *info)
+{
+	assert(f && info && info->width > 0 && info->height > 0 && cells_check_params(&info->params));
+
+	const struct cells_params *params = &info->params;
+	struct cells_buffer header = {0};
+
+	cells_write_bytes(&header, CELLS_SNAPSHOT_MAGIC, 8);
+	cells_write_u32(&header, CELLS_SNAPSHOT_VERSION);
+	cells_write_u32(&header, params->genomeLength);
+	cells_write_u32(&header, info->width);
+	cells_write_u32(&header, info->height);
+	cells_write_u64(&header, info->seed);
+	cells_write_u64(&header, info->tick);
+	cells_write_u64(&header, info->instructions);
+	cells_write_u32(&header, info->tickMode);
+	cells_write_u32(&header, info->relativeThreshold);
+	cells_write_u32(&header, params->mutationPercent);
+	cells_write_f32(&header, params->startEnergy);
+	cells_write_u32(&header, params->reproductionEnergy);
+	cells_write_u32(&header, params->maxAge);
+	cells_write_u32(&header, params->photosynthesisEnergy);
+	cells_write_f32(&header, params->attackCost);
+	cells_write_f32(&header, params->attackEnergy);
+	cells_write_f32(&header, params->moveCost);
+	cells_write_f32(&header, params->turnCost);
+	cells_write_f32(&header, params->noopCost);
+	cells_write_u64(&header, info->nextLineage);
+	cells_write_u32(&header, util_crc32(0, header.data, header.size));
+
+	const bool ok = fwrite(header.data, 1, header.size, f) == header.size;
+	free(header.data);
+
+	if (!ok)
+		return NULL;
+
+	const size_t size = (size_t)info->width * info->height;
+
+	struct cells_writer *writer = calloc(1, sizeof(struct cells_writer));
+	assert(writer);
+
+	writer->f = f;
+	writer->ok = true;
+	writer->info = *info;
+	// every cell could have its own genome, both arrays are only backed as they fill up
+	writer->genomes = genome_pool_create(size);
+	writer->genomeIds = calloc(size + 1, sizeof(*writer->genomeIds));
+	assert(writer->genomeIds);
+
+	return writer;
+}
+
+// writes out the current block, if it has any cells
+static void cells_writer_flush(struct cells_writer *writer)
+{
+	if (writer->pendingEmpty)
+	{
+		cells_write_varint(&writer->block, writer->pendingEmpty);
+		writer->blockCells += writer->pendingEmpty;
+		writer->pendingEmpty = 0;
+	}
+
+	if (writer->blockCells == 0)
+		return;
+
+	struct cells_buffer head = {0};
+	cells_write_varint(&head, writer->blockCells);
+	cells_write_varint(&head, writer->block.size);
+
+	struct cells_buffer tail = {0};
+	cells_write_u32(&tail, util_crc32(0, writer->block.data, writer->block.size));
+
+	writer->ok = writer->ok && fwrite(head.data, 1, head.size, writer->f) == head.size &&
+				 fwrite(writer->block.data, 1, writer->block.size, writer->f) == writer->block.size &&
+				 fwrite(tail.data, 1, tail.size, writer->f) == tail.size;
+
+	free(head.data);
+	free(tail.data);
+
+	writer->block.size = 0;
+	writer->blockCells = 0;
+}
+
+bool cells_writer_put(struct cells_writer *writer, const struct cell *cell)
+{
+	if (!writer->ok || writer->cells == (uint64_t)writer->info.width * writer->info.height)
+		return writer->ok = false;
+
+	writer->cells++;
+
+	if (cell->empty)
+	{
+		writer->pendingEmpty++;
+		return true;
+	}
+
+	struct cells_buffer *block = &writer->block;
+
+	cells_write_varint(block, writer->pendingEmpty);
+	writer->blockCells += writer->pendingEmpty + 1;
+	writer->pendingEmpty = 0;
+
+	cells_write_u8(block, cell->alive);
+	cells_write_f32(block, cell->energy);
+	cells_write_u8(block, cell->direction);
+	const unsigned genomeLength = writer->info.params.genomeLength;
+	cells_write_u8(block, cell->currentInstruction % genomeLength);
+	cells_write_varint(block, cell->age);
+	cells_write_f32(block, cell->r);
+	cells_write_f32(block, cell->g);
+	cells_write_f32(block, cell->b);
+	cells_write_varint(block, cell->photosynthesisCount);
+	cells_write_varint(block, cell->attackCount);
+	cells_write_varint(block, cell->eatingDeadCount);
+
+	packed_instruction genome[GENOME_MAX_LENGTH] = {0};
+
+	for (unsigned i = 0; i < genomeLength; i++)
+		genome[i] = genome_pack(&cell->genome[i]);
+
+	// the pool keeps the reference until the writer is closed
+	const genome_handle handle = genome_pool_intern(writer->genomes, genome);
+
+	if (writer->genomeIds[handle])
+		cells_write_varint(block, writer->genomeIds[handle]);
+	else
+	{
+		writer->genomeIds[handle] = ++writer->genomeCount;
+
+		cells_write_varint(block, 0);
+		for (unsigned i = 0; i < genomeLength; i++)
+			cells_write_u32(block, genome[i]);
+	}
+
+	cells_write_varint(block, cell->lineage);
+
+	if (block->size >= CELLS_BLOCK_SIZE)
+		cells_writer_flush(writer);
+
+	return writer->ok;
+}
+
+bool cells_writer_close(struct cells_writer *writer)
+{
+	cells_writer_flush(writer);
+
+	// block without cells marks the end
+	writer->ok = writer->ok && putc(0, writer->f) != EOF;
+
+	const bool ok = writer->ok && writer->cells == (uint64_t)writer->info.width * writer->info.height;
+
+	genome_pool_destroy(writer->genomes);
+	free(writer->genomeIds);
+	free(writer->block.data);
+	free(writer);
+
+	return ok;
+}
+
+struct cells_reader *cells_reader_open(FILE *f)
+{
+	assert(f);
+
+	uint8_t header[CELLS_HEADER_SIZE + 4];
+
+	// the rest of the header depends on the version
+	if (fread(header, 1, 12, f) != 12 || memcmp(header, CELLS_SNAPSHOT_MAGIC, 8) != 0)
+		return NULL;
+
+	struct cells_cursor cursor = {header, sizeof(header), 8, true};
+	struct cells_snapshot_info info;
+
+	const uint32_t version = cells_read_u32(&cursor);
+	const size_t size = version == 1 ? CELLS_HEADER_SIZE_V1 : version == 2 ? CELLS_HEADER_SIZE_V2 : CELLS_HEADER_SIZE;
+
+	if (version < 1 || version > CELLS_SNAPSHOT_VERSION || fread(header + 12, 1, size + 4 - 12, f) != size + 4 - 12)
+		return NULL;
+
+	// version 1 was written with default parameters, only the genome length could differ
+	info.params = cells_default_params();
+	info.params.genomeLength = cells_read_u32(&cursor);
+	info.width = cells_read_u32(&cursor);
+	info.height = cells_read_u32(&cursor);
+	info.seed = cells_read_u64(&cursor);
+	info.tick = cells_read_u64(&cursor);
+	info.instructions = cells_read_u64(&cursor);
+	info.tickMode = cells_read_u32(&cursor);
+	info.relativeThreshold = cells_read_u32(&cursor);
+
+	if (version >= 2)
+	{
+		info.params.mutationPercent = cells_read_u32(&cursor);
+		info.params.startEnergy = cells_read_f32(&cursor);
+		info.params.reproductionEnergy = cells_read_u32(&cursor);
+		info.params.maxAge = cells_read_u32(&cursor);
+		info.params.photosynthesisEnergy = cells_read_u32(&cursor);
+		info.params.attackCost = cells_read_f32(&cursor);
+		info.params.attackEnergy = cells_read_f32(&cursor);
+		info.params.moveCost = cells_read_f32(&cursor);
+		info.params.turnCost = cells_read_f32(&cursor);
+		info.params.noopCost = cells_read_f32(&cursor);
+	}
+
+	info.nextLineage = version >= 3 ? cells_read_u64(&cursor) : 0;
+
+	if (cells_read_u32(&cursor) != util_crc32(0, header, size))
+		return NULL;
+
+	if (!cells_check_params(&info.params) || info.width == 0 || info.height == 0 || info.tickMode > TICK_ONCE ||
+		info.relativeThreshold > GENOME_MAX_LENGTH || (version >= 3 && info.nextLineage == 0))
+		return NULL;
+
+	struct cells_reader *reader = calloc(1, sizeof(struct cells_reader));
+	assert(reader);
+
+	reader->f = f;
+	reader->ok = true;
+	reader->version = version;
+	reader->info = info;
+
+	return reader;
+}
+
+const struct cells_snapshot_info *cells_reader_info(const struct cells_reader *reader)
+{
+	return &reader->info;
+}
+
+// reads next block and checks its checksum
+static bool cells_reader_next_block(struct cells_reader *reader)
+{
+	uint64_t cells, size;
+	uint8_t crc[4];
+
+	if (!cells_read_file_varint(reader->f, &cells) || cells == 0 || !cells_read_file_varint(reader->f, &size) ||
+		size > CELLS_MAX_BLOCK_SIZE)
+		return false;
+
+	reader->block.size = 0;
+	if (size > reader->block.capacity)
 	{
-		return FOOD_SOURCE_PHOTOSYNTHESIS;
+		reader->block.capacity = size;
+		reader->block.data = realloc(reader->block.data, size);
+		assert(reader->block.data);
 	}
-	else if (max == cell.attackCount)
+
+	if (fread(reader->block.data, 1, size, reader->f) != size || fread(crc, 1, 4, reader->f) != 4)
+		return false;
+
+	reader->block.size = size;
+	reader->cursor = (struct cells_cursor){reader->block.data, size, 0, true};
+	reader->blockCells = cells;
+
+	struct cells_cursor crcCursor = {crc, 4, 0, true};
+	return cells_read_u32(&crcCursor) == util_crc32(0, reader->block.data, size);
+}
+
+// reads the genome reference of a cell
+static const packed_instruction *cells_reader_genome(struct cells_reader *reader)
+{
+	struct cells_cursor *cursor = &reader->cursor;
+	const uint64_t id = cells_read_varint(cursor);
+
+	if (id != 0)
+		return cursor->ok && id <= reader->genomeCount ? &reader->genomes[(id - 1) * GENOME_MAX_LENGTH] : NULL;
+
+	if (reader->genomeCount == reader->genomeCapacity)
+	{
+		reader->genomeCapacity = reader->genomeCapacity ? reader->genomeCapacity * 2 : 256;
+		reader->genomes = realloc(reader->genomes, (size_t)reader->genomeCapacity * GENOME_MAX_LENGTH * sizeof(packed_instruction));
+		assert(reader->genomes);
+	}
+
+	packed_instruction *genome = &reader->genomes[(size_t)reader->genomeCount++ * GENOME_MAX_LENGTH];
+	const unsigned genomeLength = reader->info.params.genomeLength;
+
+	for (unsigned i = 0; i < GENOME_MAX_LENGTH; i++)
+		genome[i] = i < genomeLength ? cells_read_u32(cursor) & GENE_MASK : 0;
+
+	return cursor->ok ? genome : NULL;
+}
+
+bool cells_reader_get(struct cells_reader *reader, struct cell *cell)
+{
+	const unsigned x = reader->cells % reader->info.width;
+	const unsigned y = reader->cells / reader->info.width;
+
+	if (!reader->ok || reader->cells == (uint64_t)reader->info.width * reader->info.height)
+		return false;
+
+	// every run of empty cells is followed by a non-empty cell, unless the block ends
+	while (!reader->pendingEmpty && !reader->pendingCell)
+	{
+		if (reader->blockCells == 0 && !cells_reader_next_block(reader))
+			return reader->ok = false;
+
+		const uint64_t run = cells_read_varint(&reader->cursor);
+		if (!reader->cursor.ok || run > reader->blockCells)
+			return reader->ok = false;
+
+		reader->blockCells -= run;
+		reader->pendingEmpty = run;
+		reader->pendingCell = reader->blockCells > 0;
+	}
+
+	reader->cells++;
+
+	if (reader->pendingEmpty)
+	{
+		reader->pendingEmpty--;
+		*cell = cells_generate_empty_cell(x, y);
+		return true;
+	}
+
+	reader->pendingCell = false;
+	reader->blockCells--;
+
+	struct cells_cursor *cursor = &reader->cursor;
+
+	cell->empty = false;
+	cell->alive = cells_read_u8(cursor);
+	cell->energy = cells_read_f32(cursor);
+	cell->direction = cells_read_u8(cursor) % 4;
+	cell->currentInstruction = cells_read_u8(cursor) % reader->info.params.genomeLength;
+	cell->age = cells_read_varint(cursor);
+	cell->x = x, cell->y = y;
+	cell->r = cells_read_f32(cursor);
+	cell->g = cells_read_f32(cursor);
+	cell->b = cells_read_f32(cursor);
+	cell->photosynthesisCount = cells_read_varint(cursor);
+	cell->attackCount = cells_read_varint(cursor);
+	cell->eatingDeadCount = cells_read_varint(cursor);
+
+	const packed_instruction *genome = cells_reader_genome(reader);
+	if (!genome)
+		return reader->ok = false;
+
+	for (int i = 0; i < GENOME_MAX_LENGTH; i++)
+		cell->genome[i] = genome_unpack(genome[i]);
+
+	cell->lineage = reader->version >= 3 ? cells_read_varint(cursor) : 0;
+
+	// later lineages get ids from nextLineage on
+	return reader->ok = cursor->ok && (reader->version < 3 || cell->lineage < reader->info.nextLineage);
+}
+
+bool cells_reader_close(struct cells_reader *reader)
+{
+	uint64_t end;
+
+	// everything has to be consumed, up to the end marker
+	const bool ok = reader->ok && reader->cells == (uint64_t)reader->info.width * reader->info.height &&
+					reader->blockCells == 0 && reader->cursor.offset == reader->cursor.size &&
+					cells_read_file_varint(reader->f, &end) && end == 0;
+
+	free(reader->block.data);
+	free(reader->genomes);
+	free(reader);
+
+	return ok;
+}
+
+bool cells_save(const struct cells_state *state, FILE *f)
+{
+	const struct cells_snapshot_info info = cells_snapshot_info(state);
+	struct cells_writer *writer = cells_writer_open(f, &info);
+
+	if (!writer)
+		return false;
+
+	struct cell cell;
+
+	for (unsigned y = 0; y < state->height; y++)
+	{
+		for (unsigned x = 0; x < state->width; x++)
+		{
+			cells_get_cell(state, x, y, &cell);
+			cells_writer_put(writer, &cell);
+		}
+	}
+
+	return cells_writer_close(writer);
+}
+
+bool cells_load(struct cells_state *state, FILE *f)
+{
+	struct cells_reader *reader = cells_reader_open(f);
+
+	if (!reader)
+		return false;
+
+	const struct cells_snapshot_info info = *cells_reader_info(reader);
+
+	if (info.width != state->width || info.height != state->height)
+	{
+		cells_reader_close(reader);
+		return false;
+	}
+
+	// cells are set with the saved parameters, age ranges of stats may change with them
+	const struct cells_stats stats = state->stats;
+	cells_apply_params(state, &info.params);
+	state->stats = cells_recount_stats(state);
+	state->stats.births = stats.births;
+	state->stats.deaths = stats.deaths;
+
+	// the replaced world never ran with the edits, so they aren't logged, files without lineages keep counting from here
+	cells_discard_lineage_edits(state);
+	if (info.nextLineage)
+		state->lineagePool->nextId = info.nextLineage;
+
+	bool ok = true;
+	struct cell cell;
+
+	for (unsigned y = 0; y < state->height && ok; y++)
 	{
-		return FOOD_SOURCE_MEAT;
+		for (unsigned x = 0; x < state->width && ok; x++)
+		{
+			if ((ok = cells_reader_get(reader, &cell)))
+				cells_set_cell(state, x, y, &cell);
+		}
 	}
-	else if (max == cell.eatingDeadCount)
+
+	// lineages of replaced cells didn't die out, new ones of cells without lineage are logged with the next tick
+	state->lineageEdits.extinctionCount = 0;
+
+	ok = cells_reader_close(reader) && ok;
+
+	if (ok)
 	{
-		return FOOD_SOURCE_DEAD_CELLS;
+		state->seed = info.seed;
+		state->tick = info.tick;
+		state->instructions = info.instructions;
+		state->tickMode = info.tickMode;
+		state->relativeThreshold = info.relativeThreshold;
 	}
+
+	return ok;
+}
+
+bool cells_parse_snapshot_format(const char *name, enum cells_snapshot_format *format)
+{
+	if (strcmp(name, "stream") == 0)
+		*format = SNAPSHOT_STREAM;
+	else if (strcmp(name, "mapped") == 0)
+		*format = SNAPSHOT_MAPPED;
 	else
+		return false;
+
+	return true;
+}
+
+#define CELLS_MAP_MAGIC "CELLSMAP"
+#define CELLS_MAP_VERSION 5
+
+// state arrays in the mapped file, pool entries go last, so the pools can grow past them
+enum cells_map_section
+{
+	MAP_ALIVE,
+	MAP_ALIVE_BITS,
+	MAP_EMPTY,
+	MAP_ENERGY,
+	MAP_DIRECTION,
+	MAP_CURRENT_INSTRUCTION,
+	MAP_AGE,
+	MAP_GENOMES,
+	MAP_COLORS,
+	MAP_COUNTERS,
+	MAP_LINEAGES,
+	MAP_ENTRIES,
+	MAP_LINEAGE_ENTRIES,
+	MAP_SECTIONS,
+};
+
+struct cells_map_header
+{
+	char magic[8];
+	uint32_t version;
+	struct cells_params params;
+	uint32_t width;
+	uint32_t height;
+	uint64_t seed;
+	uint64_t tick;
+	uint64_t instructions;
+	uint32_t tickMode;
+	uint32_t relativeThreshold;
+	uint64_t nextLineage;
+	// kept up to date by the tick, so mapping doesn't have to recount them, births and deaths are zero
+	struct cells_stats stats;
+
+	// byte order mark and sizes of the stored types, see cells_map_layout()
+	uint32_t layout[10];
+	// number of stored genome and lineage entries
+	uint32_t genomeTop;
+	uint32_t lineageTop;
+	uint32_t crc;
+	// the CRC covers the header as it is, so there's no padding
+	uint32_t reserved;
+
+	uint64_t offsets[MAP_SECTIONS];
+	uint64_t sizes[MAP_SECTIONS];
+};
+
+static void cells_map_layout(uint32_t layout[10])
+{
+	const uint32_t values[10] = {
+		0x01020304, sizeof(bool), sizeof(float), sizeof(unsigned),
+		sizeof(struct cell_color), sizeof(struct cell_counters), sizeof(genome_handle), sizeof(struct genome_entry),
+		sizeof(lineage_handle), sizeof(struct lineage_entry),
+	};
+
+	memcpy(layout, values, sizeof(values));
+}
+
+static uint64_t cells_map_align(const uint64_t offset)
+{
+	return (offset + CELLS_MAP_ALIGN - 1) / CELLS_MAP_ALIGN * CELLS_MAP_ALIGN;
+}
+
+// fills section sizes and offsets of a world with given size
+static void cells_map_sections(struct cells_map_header *header)
+{
+	const uint64_t size = (uint64_t)header->width * header->height;
+
+	header->sizes[MAP_ALIVE] = size * sizeof(bool);
+	header->sizes[MAP_ALIVE_BITS] = (size + 63) / 64 * sizeof(uint64_t);
+	header->sizes[MAP_EMPTY] = size * sizeof(bool);
+	header->sizes[MAP_ENERGY] = size * sizeof(float);
+	header->sizes[MAP_DIRECTION] = size * sizeof(uint8_t);
+	header->sizes[MAP_CURRENT_INSTRUCTION] = size * sizeof(uint8_t);
+	header->sizes[MAP_AGE] = size * sizeof(unsigned);
+	header->sizes[MAP_GENOMES] = size * sizeof(genome_handle);
+	header->sizes[MAP_COLORS] = size * sizeof(struct cell_color);
+	header->sizes[MAP_COUNTERS] = size * sizeof(struct cell_counters);
+	header->sizes[MAP_LINEAGES] = size * sizeof(lineage_handle);
+	header->sizes[MAP_ENTRIES] = (uint64_t)header->genomeTop * sizeof(struct genome_entry);
+	header->sizes[MAP_LINEAGE_ENTRIES] = (uint64_t)header->lineageTop * sizeof(struct lineage_entry);
+
+	uint64_t offset = cells_map_align(sizeof(struct cells_map_header));
+
+	for (int i = 0; i < MAP_SECTIONS; i++)
+	{
+		header->offsets[i] = offset;
+		offset = cells_map_align(offset + header->sizes[i]);
+	}
+}
+
+static uint32_t cells_map_crc(struct cells_map_header header)
+{
+	header.crc = 0;
+	return util_crc32(0, &header, sizeof(header));
+}
+
+// writes zeros up to given offset
+static bool cells_map_pad(FILE *f, uint64_t *position, const uint64_t offset)
+{
+	static const uint8_t zeros[4096];
+
+	while (*position < offset)
+	{
+		const size_t n = offset - *position < sizeof(zeros) ? offset - *position : sizeof(zeros);
+
+		if (fwrite(zeros, 1, n, f) != n)
+			return false;
+
+		*position += n;
+	}
+
+	return true;
+}
+
+bool cells_save_mapped(const struct cells_state *state, FILE *f)
+{
+	const size_t size = (size_t)state->width * state->height;
+
+	// references are recounted from this state's handles, so a clone is saved
+	// just like the original, entries used by nobody else are written as free
+	genome_handle top = GENOME_NONE;
+	for (size_t i = 0; i < size; i++)
+		top = state->genomes[i] > top ? state->genomes[i] : top;
+	top++;
+
+	uint32_t *refs = calloc(top, sizeof(uint32_t));
+	assert(refs);
+
+	for (size_t i = 0; i < size; i++)
+		refs[state->genomes[i]]++;
+
+	// same for lineages, which also count their alive cells
+	lineage_handle lineageTop = LINEAGE_NONE;
+	for (size_t i = 0; i < size; i++)
+		lineageTop = state->lineages[i] > lineageTop ? state->lineages[i] : lineageTop;
+	lineageTop++;
+
+	uint32_t *lineageRefs = calloc(lineageTop, sizeof(uint32_t));
+	uint32_t *lineageAlive = calloc(lineageTop, sizeof(uint32_t));
+	assert(lineageRefs && lineageAlive);
+
+	for (size_t i = 0; i < size; i++)
+	{
+		lineageRefs[state->lineages[i]]++;
+		lineageAlive[state->lineages[i]] += state->alive[i] && !state->empty[i];
+	}
+
+	struct cells_map_header header = {
+		.magic = CELLS_MAP_MAGIC,
+		.version = CELLS_MAP_VERSION,
+		.params = state->params,
+		.width = state->width,
+		.height = state->height,
+		.seed = state->seed,
+		.tick = state->tick,
+		.instructions = state->instructions,
+		.tickMode = state->tickMode,
+		.relativeThreshold = state->relativeThreshold,
+		.nextLineage = cells_next_lineage(state),
+		.stats = state->stats,
+		.genomeTop = top,
+		.lineageTop = lineageTop,
+	};
+
+	header.stats.births = 0;
+	header.stats.deaths = 0;
+
+	cells_map_layout(header.layout);
+	cells_map_sections(&header);
+	header.crc = cells_map_crc(header);
+
+	const void *arrays[MAP_ENTRIES] = {
+		state->alive, state->aliveBits, state->empty, state->energy, state->direction, state->currentInstruction,
+		state->age, state->genomes, state->colors, state->counters, state->lineages,
+	};
+
+	uint64_t position = sizeof(header);
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+	for (int i = 0; i < MAP_ENTRIES && ok; i++)
+	{
+		ok = cells_map_pad(f, &position, header.offsets[i]) && fwrite(arrays[i], 1, header.sizes[i], f) == header.sizes[i];
+		position += header.sizes[i];
+	}
+
+	ok = ok && cells_map_pad(f, &position, header.offsets[MAP_ENTRIES]);
+
+	for (genome_handle handle = GENOME_NONE; handle < top && ok; handle++)
+	{
+		struct genome_entry entry = {0};
+
+		// unused entries may be reused by the original meanwhile, so they're not even read,
+		// and refs of used ones are changed by it, only the immutable parts are copied
+		if (handle == GENOME_NONE || refs[handle])
+		{
+			const struct genome_entry *stored = genome_pool_get(state->genomePool, handle);
+
+			memcpy(entry.instructions, stored->instructions, sizeof(entry.instructions));
+			memcpy(entry.opcodes, stored->opcodes, sizeof(entry.opcodes));
+			entry.hash = stored->hash;
+			entry.refs = refs[handle];
+			entry.used = true;
+		}
+
+		entry.nextFree = GENOME_NONE;
+		ok = fwrite(&entry, sizeof(entry), 1, f) == 1;
+	}
+
+	position += (uint64_t)top * sizeof(struct genome_entry);
+	ok = ok && cells_map_pad(f, &position, header.offsets[MAP_LINEAGE_ENTRIES]);
+
+	for (lineage_handle handle = LINEAGE_NONE; handle < lineageTop && ok; handle++)
+	{
+		struct lineage_entry entry = {0};
+
+		// ids don't change once they're logged, births of edits are taken as logged
+		if (handle == LINEAGE_NONE)
+			entry.used = true;
+		else if (lineageRefs[handle])
+		{
+			entry.id = lineage_pool_get(state->lineagePool, handle)->id;
+			entry.alive = lineageAlive[handle];
+			entry.refs = lineageRefs[handle];
+			entry.used = true;
+		}
+
+		ok = fwrite(&entry, sizeof(entry), 1, f) == 1;
+	}
+
+	free(refs);
+	free(lineageRefs);
+	free(lineageAlive);
+
+	return ok;
+}
+
+// reserves room for a pool of mappingSize bytes, which starts with the entries of the section
+static void *cells_map_entries(const int fd, const struct cells_map_header *header, const enum cells_map_section section,
+							   const size_t mappingSize)
+{
+	void *entries = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (entries != MAP_FAILED && mmap(entries, header->sizes[section], PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+									  header->offsets[section]) == MAP_FAILED)
+	{
+		munmap(entries, mappingSize);
+		return MAP_FAILED;
+	}
+
+	return entries;
+}
+
+/*
+	Checks the cell arrays the tick indexes with, so a damaged file can't
+	make it read past the pools or a genome: handles below the stored
+	tops, instructions within the genome length, directions, flags, which
+	are 0 or 1, no alive empty cells and aliveBits matching alive.
+*/
+static bool cells_map_check(const struct cells_map_header *header, const uint8_t *mapping)
+{
+	const size_t size = (size_t)header->width * header->height;
+	const uint8_t *alive = mapping + header->offsets[MAP_ALIVE];
+	const uint64_t *aliveBits = (const uint64_t *)(mapping + header->offsets[MAP_ALIVE_BITS]);
+	const uint8_t *empty = mapping + header->offsets[MAP_EMPTY];
+	const uint8_t *direction = mapping + header->offsets[MAP_DIRECTION];
+	const uint8_t *currentInstruction = mapping + header->offsets[MAP_CURRENT_INSTRUCTION];
+	const genome_handle *genomes = (const genome_handle *)(mapping + header->offsets[MAP_GENOMES]);
+	const lineage_handle *lineages = (const lineage_handle *)(mapping + header->offsets[MAP_LINEAGES]);
+
+	genome_handle genomeMax = GENOME_NONE;
+	lineage_handle lineageMax = LINEAGE_NONE;
+	bool bad = false;
+
+	for (size_t word = 0; word < (size + 63) / 64; word++)
+	{
+		const size_t end = size - word * 64 < 64 ? size : word * 64 + 64;
+		uint64_t bits = 0;
+
+		// no early exit, a valid file is read through anyway
+		for (size_t i = word * 64; i < end; i++)
+		{
+			bits |= (uint64_t)(alive[i] & 1) << (i % 64);
+			bad |= alive[i] > 1 || empty[i] > 1 || (alive[i] && empty[i]) || direction[i] > DOWN ||
+				   currentInstruction[i] >= header->params.genomeLength;
+			genomeMax = genomes[i] > genomeMax ? genomes[i] : genomeMax;
+			lineageMax = lineages[i] > lineageMax ? lineages[i] : lineageMax;
+		}
+
+		bad |= bits != aliveBits[word];
+	}
+
+	return !bad && genomeMax < header->genomeTop && lineageMax < header->lineageTop;
+}
+
+struct cells_state *cells_map(FILE *f)
+{
+	const int fd = fileno(f);
+	const long page = sysconf(_SC_PAGESIZE);
+	struct cells_map_header header;
+	struct stat st;
+
+	if (page <= 0 || CELLS_MAP_ALIGN % page != 0)
+		return NULL;
+
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, CELLS_MAP_MAGIC, 8) != 0 ||
+		header.crc != cells_map_crc(header) || fstat(fd, &st) != 0)
+		return NULL;
+
+	// the sections have to be exactly where this build would put them
+	struct cells_map_header expected = header;
+	cells_map_layout(expected.layout);
+	cells_map_sections(&expected);
+
+	const uint64_t size = (uint64_t)header.width * header.height;
+	// same capacities as cells_init(), the file covers the first genomeTop and lineageTop entries
+	uint32_t capacity = size < UINT32_MAX ? cells_genome_capacity(size) : 0;
+	uint32_t lineageCapacity = size < UINT32_MAX ? cells_lineage_capacity(size) : 0;
+	// the pools may have grown past them
+	if (header.genomeTop > capacity)
+		capacity = header.genomeTop - 1;
+	if (header.lineageTop > lineageCapacity)
+		lineageCapacity = header.lineageTop - 1;
+
+	if (header.version != CELLS_MAP_VERSION || !cells_check_params(&header.params) || header.width == 0 ||
+		header.height == 0 || size >= UINT32_MAX || header.tickMode > TICK_ONCE ||
+		header.relativeThreshold > GENOME_MAX_LENGTH || header.nextLineage == 0 || header.genomeTop == 0 ||
+		header.lineageTop == 0 || header.stats.alive + header.stats.dead + header.stats.empty != (long long)size ||
+		memcmp(&header, &expected, sizeof(header)) != 0 ||
+		(uint64_t)st.st_size != header.offsets[MAP_LINEAGE_ENTRIES] + header.sizes[MAP_LINEAGE_ENTRIES])
+		return NULL;
+
+	uint8_t *mapping = mmap(NULL, header.offsets[MAP_ENTRIES], PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+		return NULL;
+
+	const size_t entriesSize = genome_pool_block_size(capacity);
+	const size_t lineageEntriesSize = lineage_pool_block_size(lineageCapacity);
+
+	const genome_handle *genomes = (const genome_handle *)(mapping + header.offsets[MAP_GENOMES]);
+	const lineage_handle *lineages = (const lineage_handle *)(mapping + header.offsets[MAP_LINEAGES]);
+
+	void *entries = cells_map_check(&header, mapping) ? cells_map_entries(fd, &header, MAP_ENTRIES, entriesSize) : MAP_FAILED;
+	void *lineageEntries = entries != MAP_FAILED ? cells_map_entries(fd, &header, MAP_LINEAGE_ENTRIES, lineageEntriesSize) : MAP_FAILED;
+	struct lineage_pool *lineagePool = lineageEntries != MAP_FAILED ? lineage_pool_map(lineageEntries, lineageEntriesSize,
+																						  header.lineageTop, header.nextLineage)
+																	: NULL;
+
+	if (!lineagePool)
+	{
+		if (lineageEntries != MAP_FAILED)
+			munmap(lineageEntries, lineageEntriesSize);
+		if (entries != MAP_FAILED)
+			munmap(entries, entriesSize);
+		munmap(mapping, header.offsets[MAP_ENTRIES]);
+		return NULL;
+	}
+
+	struct cells_state *state = calloc(1, sizeof(struct cells_state));
+	assert(state);
+
+	state->width = header.width;
+	state->height = header.height;
+
+	state->mapping = mapping;
+	state->mappingSize = header.offsets[MAP_ENTRIES];
+
+	state->alive = (bool *)(mapping + header.offsets[MAP_ALIVE]);
+	state->aliveBits = (uint64_t *)(mapping + header.offsets[MAP_ALIVE_BITS]);
+	state->empty = (bool *)(mapping + header.offsets[MAP_EMPTY]);
+	state->energy = (float *)(mapping + header.offsets[MAP_ENERGY]);
+	state->direction = mapping + header.offsets[MAP_DIRECTION];
+	state->currentInstruction = mapping + header.offsets[MAP_CURRENT_INSTRUCTION];
+	state->age = (unsigned *)(mapping + header.offsets[MAP_AGE]);
+	state->genomes = (genome_handle *)genomes;
+	state->colors = (struct cell_color *)(mapping + header.offsets[MAP_COLORS]);
+	state->counters = (struct cell_counters *)(mapping + header.offsets[MAP_COUNTERS]);
+	state->lineages = (lineage_handle *)lineages;
+
+	state->actedBits = calloc((size + 63) / 64, sizeof(*state->actedBits));
+	state->spanVersions = calloc(cells_span_count(state), sizeof(*state->spanVersions));
+	assert(state->actedBits && state->spanVersions);
+
+	state->genomePool = genome_pool_map(entries, entriesSize, header.genomeTop);
+	cells_apply_params(state, &header.params);
+	state->stats = header.stats;
+
+	state->seed = header.seed;
+	state->tick = header.tick;
+	state->instructions = header.instructions;
+	state->tickMode = header.tickMode;
+	state->relativeThreshold = header.relativeThreshold;
+	cells_split_tiles(state);
+
+	cells_init_lineage_events(state);
+	state->lineagePool = lineagePool;
+
+	return state;
+}
+
+struct cells_state *cells_open(FILE *f)
+{
+	char magic[8];
+
+	if (fread(magic, 1, 8, f) != 8 || fseek(f, 0, SEEK_SET) != 0)
+		return NULL;
+
+	if (memcmp(magic, CELLS_MAP_MAGIC, 8) == 0)
+		return cells_map(f);
+
+	struct cells_reader *reader = cells_reader_open(f);
+	if (!reader)
+		return NULL;
+
+	const struct cells_snapshot_info info = *cells_reader_info(reader);
+	cells_reader_close(reader);
+
+	if (fseek(f, 0, SEEK_SET) != 0)
+		return NULL;
+
+	// every cell is loaded from the file, so there's nothing to populate
+	struct cells_state *state = cells_init(info.width, info.height, info.seed, &info.params, 0);
+
+	if (!cells_load(state, f))
 	{
-		return FOOD_SOURCE_UNKNOWN;
+		cells_quit(state);
+		return NULL;
 	}
-}
\ No newline at end of file
+
+	return state;
+}
@@ -2,54 +2,12 @@
 #define CELLS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "defines.h"
-
-enum gen_instruction
-{
-	// do nothing
-	NOOP,
-
-	// movement
-	TURN_LEFT,
-	TURN_RIGHT,
-	MOVE_FORWARDS,
-
-	PHOTOSYNTHESIS,
-
-	// gives e energy to cell in front
-	GIVE_ENERGY,
-
-	// attacks cell in front
-	// if cell class is hunter cell, it kills the cell immediately
-	ATTACK_CELL,
-
-	// eats dead cell in front
-	RECYCLE_DEAD_CELL,
-
-	// jump to instruction b1 if cell has more than e energy
-	// otherwise, jump to instruction b2
-	CHECK_ENERGY,
-
-	// if left -> b1
-	// if right ->
-	CHECK_ROTATION,
-
-	// jump to instruction BX, if there's alive cell in front
-	JMP_IF_FACING_ALIVE_CELL,
-
-	// jump to instruction BX, if there's dead cell in front
-	JMP_IF_FACING_DEAD_CELL,
-
-	// jump to instruction BX, if facing empty space
-	JMP_IF_FACING_VOID,
-
-	// if cell's genome is at least CX% similar to other's cell genome, jumping to instruction bx
-	JMP_IF_FACING_RELATIVE,
-
-	// works, if cell has more than REPRODUCTION_REQUIRED_ENERGY energy
-	MAKE_CHILD
-};
+#include "genome.h"
+#include "lineage.h"
 
 enum direction
 {
@@ -67,31 +25,70 @@ enum cell_food_source
 	FOOD_SOURCE_UNKNOWN,
 };
 
-struct instruction
+/*
+	Parameters of the simulation. Defaults come from defines.h, they can be
+	changed by name with cells_set_param(), so from the command line or a
+	config file, without a rebuild. Snapshots keep them.
+*/
+struct cells_params
 {
-	enum gen_instruction command;
-
-	// those are "arguments" for main instruction
-	// opt is a boolean. in some instructions, alters it
-	// e stores energy from 0 to REPRODUCTION_REQUIRED_ENERGY, and is used in JMP_IF_LESS/JMP_IF_GREATER
-	// b1 and b2 are branches for JMP instructions
-	// b3 and b4 are branches for CHECK_ROTATION
-	// if the JMP condition is true, jumps to instruction b1
-	// otherwise, to instruction b2
-	bool opt;
-	uint8_t e;	// energy condition
-	uint8_t b1; // branch 1
-	uint8_t b2; // branch 2
-	uint8_t b3; // branch 3
-	uint8_t b4; // branch 4
+	// instructions in a genome, up to GENOME_MAX_LENGTH
+	unsigned genomeLength;
+	// percent of children, whose genome mutates
+	unsigned mutationPercent;
+
+	float startEnergy;
+	// energy needed to make a child, it also limits energy arguments of instructions
+	unsigned reproductionEnergy;
+	// older cells die
+	unsigned maxAge;
+
+	// halved as a whole number for cells, which attacked more than they photosynthesised
+	unsigned photosynthesisEnergy;
+	// energy an attack takes from the attacker
+	float attackCost;
+	// fraction of the attacked cell's energy the attacker gets
+	float attackEnergy;
+
+	float moveCost;
+	float turnCost;
+	// every instruction costs at least that much
+	float noopCost;
 };
 
+// returns parameters from defines.h
+struct cells_params cells_default_params(void);
+
+/*
+	Sets parameter with given name ( genome-length, mutation-percent,
+	start-energy, reproduction-energy, max-age, photosynthesis-energy,
+	attack-cost, attack-energy, move-cost, turn-cost or noop-cost ).
+	Returns false for unknown names, exits on invalid values.
+*/
+bool cells_set_param(struct cells_params *params, const char *name, const char *value);
+
+// same, from "name=value", returns false if there's no = or the name is unknown
+bool cells_parse_param(struct cells_params *params, const char *pair);
+
+/*
+	Sets parameters from a file of name=value pairs, separated by spaces
+	or lines, # starts a comment. Returns false if the file can't be read
+	or has unknown names.
+*/
+bool cells_load_params(struct cells_params *params, const char *path);
+
+// returns true if all parameters are in their ranges, files can hold anything
+bool cells_check_params(const struct cells_params *params);
+
+struct util_rng;
+
 // returns randomly generated instruction
-struct instruction cells_generate_instruction();
+struct instruction cells_generate_instruction(struct util_rng *rng, const struct cells_params *params);
 
 struct cell
 {
-	struct instruction genome[GENOME_LENGTH];
+	// instructions past the genome length are zero
+	struct instruction genome[GENOME_MAX_LENGTH];
 	unsigned currentInstruction;
 
 	enum direction direction;
@@ -111,49 +108,443 @@ struct cell
 	unsigned photosynthesisCount;
 	unsigned attackCount;
 	unsigned eatingDeadCount;
+
+	// id of the cell's lineage, 0 if it has none, cells_set_cell() starts a new one for an alive cell without it
+	uint64_t lineage;
 };
 
 // returns randomly generated cell
-struct cell cells_generate_cell(const unsigned x, const unsigned y);
+struct cell cells_generate_cell(struct util_rng *rng, const struct cells_params *params, const unsigned x, const unsigned y);
 
 // returns empty cell
 struct cell cells_generate_empty_cell(const unsigned x, const unsigned y);
 
-// independent cell simulation
+struct cell_color
+{
+	float r;
+	float g;
+	float b;
+};
+
+struct cell_counters
+{
+	unsigned photosynthesisCount;
+	unsigned attackCount;
+	unsigned eatingDeadCount;
+};
+
+struct pool;
+
+enum cells_tick_mode
+{
+	// cells are updated in place while walking the world, so a cell which
+	// moved or was born further along can act again in the same tick
+	TICK_IN_PLACE,
+
+	// every cell acts exactly once per tick, newborns wait for the next one
+	TICK_ONCE,
+};
+
+// rectangular part of the world [x0, x1) x [y0, y1)
+struct cells_tile
+{
+	unsigned x0, y0;
+	unsigned x1, y1;
+};
+
+// energy in struct cells_stats is kept in 1 / CELLS_ENERGY_SCALE units, integer sums don't depend on the order
+#define CELLS_ENERGY_SCALE 65536
+
+// alive cells are split by age into that many ranges of a power of two ticks, about max age / CELLS_AGE_BUCKETS
+#define CELLS_AGE_BUCKETS 8
+
+/*
+	Population statistics, kept up to date by every change of the world,
+	so reading them costs nothing. They always equal cells_recount_stats(),
+	the tick counts only what an update really changed, into its tile's
+	context, and tiles add their changes when they're done. Fields are
+	signed, so the same struct holds changes.
+*/
+struct cells_stats
+{
+	long long alive;
+	long long dead;
+	long long empty;
+
+	long long aliveEnergy;
+	long long deadEnergy;
+
+	// alive cells by cells_get_cell_food_source()
+	long long foodSources[FOOD_SOURCE_UNKNOWN + 1];
+	// alive cells by age, the last range also holds older cells ( see cells_state.ageShift )
+	long long ages[CELLS_AGE_BUCKETS];
+
+	// since the state was created, they aren't saved in snapshots
+	long long births;
+	long long deaths;
+};
+
+#ifdef CELLS_PROFILE
+// counters of one opcode, energy in 1 / CELLS_ENERGY_SCALE units
+struct cells_opcode_profile
+{
+	unsigned long long executions;
+	// CHECK_ENERGY and JMP_* jumping to b1, CHECK_ROTATION always jumps
+	unsigned long long taken;
+
+	// energy the executing cell lost or got by the whole update
+	long long consumed;
+	long long gained;
+};
+
+/*
+	What the genome interpreter spends its time and energy on, counted
+	only in builds with CELLS_PROFILE defined ( make PROFILE=1 ). Every
+	tile counts into its context, tiles add their counts to state->profile
+	when they're done, so it holds the last tick.
+*/
+struct cells_profile
+{
+	struct cells_opcode_profile opcodes[MAKE_CHILD + 1];
+};
+#endif
+
+// lineages, which appeared and died out in a tile or by edits, until they're logged at the end of the tick
+struct cells_lineage_events
+{
+	// new lineages, in the order they were minted
+	lineage_handle *births;
+	uint32_t birthCount;
+	uint32_t birthCapacity;
+
+	// ids of logged lineages, whose last alive cell died
+	uint64_t *extinctions;
+	uint32_t extinctionCount;
+	uint32_t extinctionCapacity;
+};
+
+// per tile data, used while the tile is being updated
+struct cells_context
+{
+	// random key of the current tick, cells draw from util_rng_init(key, cell index)
+	uint64_t key;
+
+	// genome instructions executed in the tile
+	unsigned long long instructions;
+
+	// changes of state->stats made by the tile
+	struct cells_stats stats;
+
+	// events of the tile, state->lineageEvents[tile]
+	struct cells_lineage_events *lineage;
+
+#ifdef CELLS_PROFILE
+	struct cells_profile profile;
+#endif
+};
+
+/*
+	Independent cell simulation.
+	Cells are stored as structure of arrays, every array has width * height
+	entries, indexed by cells_index(). The tick only streams through the hot
+	arrays, genomes and the rarely used data live in their own arrays.
+	Genomes are immutable and shared between clones, cells only hold
+	handles into the genome pool. Lineages are held the same way.
+	struct cell is used only to pass a single cell in and out of the state.
+*/
 struct cells_state
 {
 	unsigned width;
 	unsigned height;
 
-	struct cell cells[SIMULATION_WIDTH][SIMULATION_HEIGHT];
+	// hot state
+	bool *alive;
+	// same as alive, one bit per cell, the tick only visits set bits
+	uint64_t *aliveBits;
+	bool *empty;
+	float *energy;
+	uint8_t *direction;
+	uint8_t *currentInstruction;
+	unsigned *age;
+	// TICK_ONCE only: cells which moved or were born during the current tick, one bit per cell
+	uint64_t *actedBits;
+
+	// genome of every cell, shared through genomePool ( see cells_genome() )
+	genome_handle *genomes;
+	struct genome_pool *genomePool;
+	// lineage of every non-empty cell, dead cells without one hold LINEAGE_NONE
+	lineage_handle *lineages;
+	struct lineage_pool *lineagePool;
+	// made by cells_clone(), shares genomePool and lineagePool of the original
+	bool clone;
+	// clones only: id the next lineage got when the copy was taken, the original goes on minting
+	uint64_t nextLineage;
+	// cells_map() only: the file mapping, which holds the cell arrays
+	void *mapping;
+	size_t mappingSize;
+
+	// cold state
+	struct cell_color *colors;
+	struct cell_counters *counters;
+
+	/*
+		Change tracking, for drawing and sending only what changed.
+		version grows before every tick and every edit from outside. Every
+		SPAN_SIZE cells ( in index order ) keep the version, at which any
+		of them last changed the way they look: alive, empty or colour.
+		Energy, age and counters change every tick and aren't tracked.
+		Clones don't have it.
+	*/
+	unsigned long long version;
+	unsigned long long *spanVersions;
+
+	struct cells_stats stats;
+
+#ifdef CELLS_PROFILE
+	// counts of the last tick
+	struct cells_profile profile;
+#endif
+
+	// tick scheduling ( see cells_update_state() )
+	unsigned long long tick;
+	// genome instructions executed since cells_init()
+	unsigned long long instructions;
+	uint64_t seed;
+	enum cells_tick_mode tickMode;
+	// JMP_IF_FACING_RELATIVE treats cells with at least that many equal commands as relatives
+	unsigned relativeThreshold;
+	// set by cells_init(), cells_load() or cells_map() only, stats depend on it
+	struct cells_params params;
+	// age range of a cell in stats is age >> ageShift
+	unsigned ageShift;
+	struct pool *pool;
+	struct cells_tile *tiles;
+	unsigned tileCount;
+	// tiles of phase p are tiles[phases[p]] .. tiles[phases[p + 1] - 1]
+	unsigned phases[5];
+
+	// lineage events of every tile during the tick and of edits between ticks
+	struct cells_lineage_events *lineageEvents;
+	struct cells_lineage_events lineageEdits;
+	// where the events go, see cells_set_lineage_log()
+	struct lineage_log *lineageLog;
 };
 
-// updates given cell
-void cells_update_cell(struct cells_state *state, struct cell cell);
+// returns offset of the cell at given position in the state arrays
+static inline size_t cells_index(const struct cells_state *state, const unsigned x, const unsigned y)
+{
+	return (size_t)y * state->width + x;
+}
+
+// returns genome of the cell with given offset
+static inline const packed_instruction *cells_genome(const struct cells_state *state, const size_t index)
+{
+	return genome_pool_get(state->genomePool, state->genomes[index])->instructions;
+}
+
+// returns number of entries in state->spanVersions
+static inline size_t cells_span_count(const struct cells_state *state)
+{
+	return ((size_t)state->width * state->height + SPAN_SIZE - 1) / SPAN_SIZE;
+}
+
+// returns true if cells of given span changed after given version
+static inline bool cells_span_changed(const struct cells_state *state, const size_t span, const unsigned long long version)
+{
+	return state->spanVersions[span] > version;
+}
+
+// updates cell at given position in place
+void cells_update_cell(struct cells_state *state, struct cells_context *context, const unsigned x, const unsigned y);
 
-struct cells_state *cells_init();
+// allocates a width x height world, density percent of cells get random genome, same seed and parameters give the same run
+struct cells_state *cells_init(const unsigned width, const unsigned height, const uint64_t seed, const struct cells_params *params,
+							   const unsigned density);
+
+// refills the world, density percent of cells get random genome, the rest is empty
+void cells_populate(struct cells_state *state, const unsigned density);
+
+/*
+	Returns a copy of the world, which can only be read, saved and freed.
+	The copy shares genomes and lineages with the original, so it has to
+	be freed with cells_quit() before the original. Both can be used from
+	different threads meanwhile. The pools start with room for one copy,
+	more of them make the pools grow, see struct genome_pool.
+*/
+struct cells_state *cells_clone(const struct cells_state *state);
+
+// returns number of bytes allocated for the state
+size_t cells_memory_usage(const struct cells_state *state);
 
 // Un-allocates memory and sets state to NULL
 void cells_quit(struct cells_state *state);
 
-// Updates the simulation
+/*
+	Updates the simulation.
+	The world is split into tiles of about TILE_SIZE cells, coloured like a
+	checkerboard in four phases. Tiles of one phase are at least two cells
+	apart, so they never touch the same cells and run in parallel. The
+	result is always the same as updating phases one after another, tiles
+	in order and cells row by row, no matter how many threads are used.
+*/
 void cells_update_state(struct cells_state *state);
 
+// returns random key of the current tick, derived from the seed
+uint64_t cells_tick_key(const struct cells_state *state);
+
+// parses "in-place" or "once", returns false for anything else
+bool cells_parse_tick_mode(const char *name, enum cells_tick_mode *mode);
+
+// sets number of threads used by cells_update_state()
+void cells_set_threads(struct cells_state *state, const unsigned threads);
+
+/*
+	Sets log, which gets births and extinctions of lineages, NULL stops
+	logging. The caller keeps owning it. Events of a tick are written when
+	it's done, edits between ticks go to a block of the tick they happened
+	at, before the next one runs. Lineages of a new or loaded state are
+	logged with the first tick.
+*/
+void cells_set_lineage_log(struct cells_state *state, struct lineage_log *log);
+
 /*
-	Returns cell at given position.
-	If position is invalid, returns NULL
+	Copies cell at given position to *cell.
+	If position is invalid, returns false
 */
-struct cell *cells_get_cell(struct cells_state *state, const unsigned x, const unsigned y);
+bool cells_get_cell(const struct cells_state *state, const unsigned x, const unsigned y, struct cell *cell);
 
 /*
 	Sets cell at given position.
-	If position or CELLS_Cell pointer is invalid, doesn't do anything
+	If position or cell pointer is invalid, doesn't do anything
+*/
+void cells_set_cell(struct cells_state *state, const unsigned x, const unsigned y, const struct cell *cell);
+
+// turns cell with given offset into empty space
+void cells_clear_cell(struct cells_state *state, const size_t index);
+
+// returns number of alive cells in given state, kept in state->stats
+unsigned cells_count_alive_cells(const struct cells_state *state);
+
+// returns statistics counted from scratch, state->stats has to be equal to it, except for births and deaths
+struct cells_stats cells_recount_stats(const struct cells_state *state);
+
+#ifdef CELLS_PROFILE
+// adds counts of a tick to a total
+void cells_profile_add(struct cells_profile *total, const struct cells_profile *profile);
+
+// prints a line for every executed opcode
+void cells_profile_report(FILE *f, const struct cells_profile *profile);
+#endif
+
+enum cell_food_source cells_get_cell_food_source(const struct cells_state *state, const size_t index);
+
+/*
+	Snapshot file format, all numbers are little endian.
+	Header: "CELLSNAP", version, genome length, width, height, seed, tick,
+	instructions, tick mode, relative threshold, the rest of cells_params
+	in the order of its fields, id of the next lineage and CRC-32 of all
+	that. Version 1 had no parameters, such files are read with defaults,
+	versions before 3 had no lineages, their alive cells start new ones.
+	Then blocks of cells in row-major order: number of cells in the block
+	and payload size as varints, payload and its CRC-32. Payload is a
+	sequence of empty run length ( varint ) followed by one non-empty cell.
+	A genome is written in full the first time, genome length
+	instructions, later cells refer to it by number. Lineage id follows
+	the genome. A block with zero cells ends the file.
+*/
+#define CELLS_SNAPSHOT_VERSION 3
+
+// snapshot header
+struct cells_snapshot_info
+{
+	unsigned width;
+	unsigned height;
+	uint64_t seed;
+	unsigned long long tick;
+	unsigned long long instructions;
+	enum cells_tick_mode tickMode;
+	unsigned relativeThreshold;
+	struct cells_params params;
+	// id the next new lineage gets, 0 in files without lineages
+	uint64_t nextLineage;
+};
+
+struct cells_writer;
+struct cells_reader;
+
+// returns header of the snapshot, which would be written for given state
+struct cells_snapshot_info cells_snapshot_info(const struct cells_state *state);
+
+/*
+	Streaming snapshot writer, takes width * height cells in row-major order.
+	Only a block of cells and table of seen genomes are kept in memory.
+	Returns NULL if the header couldn't be written.
 */
-void cells_set_cell(struct cells_state *state, const unsigned x, const unsigned y, const struct cell cell);
+struct cells_writer *cells_writer_open(FILE *f, const struct cells_snapshot_info *info);
+
+// returns false after any write error, or if there are too many cells
+bool cells_writer_put(struct cells_writer *writer, const struct cell *cell);
+
+// finishes the file and frees the writer, returns false if anything failed or cells are missing
+bool cells_writer_close(struct cells_writer *writer);
+
+// streaming snapshot reader, returns NULL if the header is broken or of unknown version
+struct cells_reader *cells_reader_open(FILE *f);
 
-// returns number of alive cells in given state
-unsigned cells_count_alive_cells(struct cells_state *state);
+const struct cells_snapshot_info *cells_reader_info(const struct cells_reader *reader);
+
+// reads next cell, returns false on corrupted data or after the last cell
+bool cells_reader_get(struct cells_reader *reader, struct cell *cell);
+
+// frees the reader, returns true only if all cells were read and checksums matched
+bool cells_reader_close(struct cells_reader *reader);
+
+/*
+	Writes the whole state as a snapshot / reads it back, together with seed,
+	tick and parameters from the header.
+	Loading fails if the file was saved with a different world size. A
+	corrupted file may leave the state partially loaded.
+*/
+bool cells_save(const struct cells_state *state, FILE *f);
+bool cells_load(struct cells_state *state, FILE *f);
+
+enum cells_snapshot_format
+{
+	// cells_save(), compact and portable
+	SNAPSHOT_STREAM,
+
+	// cells_save_mapped(), opened instantly by cells_map()
+	SNAPSHOT_MAPPED,
+};
+
+// parses "stream" or "mapped", returns false for anything else
+bool cells_parse_snapshot_format(const char *name, enum cells_snapshot_format *format);
+
+// sections of mapped snapshots start at multiples of it, covers 4K to 64K pages
+#define CELLS_MAP_ALIGN 65536
+
+/*
+	Writes the state in the mapped format: header with the same fields as
+	the stream one and the stats, then the raw state arrays, genome and
+	lineage handles included, genome pool entries and lineage pool
+	entries, each starting at a CELLS_MAP_ALIGN boundary. It's as big as
+	the state and only readable by builds with the same data layout,
+	which the header records. Only the header has a checksum, the arrays
+	are used straight from the file.
+*/
+bool cells_save_mapped(const struct cells_state *state, FILE *f);
+
+/*
+	Opens a mapped snapshot, the state runs right on the file pages
+	( MAP_PRIVATE, so the file itself never changes ). Opening reads the
+	genome and lineage handles of all cells, which mustn't point past the
+	pools, and the pool entries, to rebuild their hash tables. The other
+	arrays are read in as the simulation touches them. Returns NULL if
+	the file isn't a mapped snapshot of this build or it's damaged.
+*/
+struct cells_state *cells_map(FILE *f);
 
-enum cell_food_source cells_get_cell_food_source(struct cell cell);
+// opens snapshot of either format as a new state, returns NULL on failure
+struct cells_state *cells_open(FILE *f);
 
-#endif
\ No newline at end of file
+#endif
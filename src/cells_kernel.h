@@ -0,0 +1,150 @@
+/*
+	Body of a kernel updating one cell, cells.c includes it once for every
+	kernel, with CELLS_KERNEL set to the function name and
+	CELLS_KERNEL_LENGTH to the genome length, a constant for common ones.
+	Functions with computed goto are never inlined, so they can't be
+	specialised by the compiler from one inline function.
+*/
+
+static void CELLS_KERNEL(struct cells_state *state, struct cells_context *context, const unsigned x, const unsigned y)
+{
+	const unsigned genomeLength = CELLS_KERNEL_LENGTH;
+
+	assert(state && context);
+
+	if (x >= state->width || y >= state->height)
+		return;
+
+	const size_t index = cells_index(state, x, y);
+
+	if (!state->alive[index])
+		return;
+
+	const unsigned current = state->currentInstruction[index];
+
+	struct cells_vm vm = {
+		.state = state,
+		.context = context,
+		.index = index,
+		.instruction = cells_genome(state, index)[current],
+		.nextInstruction = current + 1,
+		.consumedEnergy = state->params.noopCost,
+	};
+
+	// garbage from a loaded file acts as NOOP
+	const unsigned opcode = genome_command(vm.instruction) <= MAKE_CHILD ? genome_command(vm.instruction) : NOOP;
+
+	if (cells_opcode_facing[opcode])
+		vm.front = cells_facing(state, x, y, state->direction[index]);
+
+	// handlers count changes of other cells and food sources, the rest is counted when the update is done
+	const float energyBefore = state->energy[index];
+
+	// computed goto, handlers get inlined and vm stays in registers
+	static const void *const dispatch[] = {
+		[NOOP] = &&noop,
+		[TURN_LEFT] = &&turn_left,
+		[TURN_RIGHT] = &&turn_right,
+		[MOVE_FORWARDS] = &&move_forwards,
+		[PHOTOSYNTHESIS] = &&photosynthesis,
+		[GIVE_ENERGY] = &&give_energy,
+		[ATTACK_CELL] = &&attack_cell,
+		[RECYCLE_DEAD_CELL] = &&recycle_dead_cell,
+		[CHECK_ENERGY] = &&check_energy,
+		[CHECK_ROTATION] = &&check_rotation,
+		[JMP_IF_FACING_ALIVE_CELL] = &&jmp_if_facing_alive_cell,
+		[JMP_IF_FACING_DEAD_CELL] = &&jmp_if_facing_dead_cell,
+		[JMP_IF_FACING_VOID] = &&jmp_if_facing_void,
+		[JMP_IF_FACING_RELATIVE] = &&jmp_if_facing_relative,
+		[MAKE_CHILD] = &&make_child,
+	};
+
+	goto *dispatch[opcode];
+
+noop:
+	cells_op_noop(&vm);
+	goto done;
+turn_left:
+	cells_op_turn_left(&vm);
+	goto done;
+turn_right:
+	cells_op_turn_right(&vm);
+	goto done;
+move_forwards:
+	cells_op_move_forwards(&vm);
+	goto done;
+photosynthesis:
+	cells_op_photosynthesis(&vm);
+	goto done;
+give_energy:
+	cells_op_give_energy(&vm);
+	goto done;
+attack_cell:
+	cells_op_attack_cell(&vm);
+	goto done;
+recycle_dead_cell:
+	cells_op_recycle_dead_cell(&vm);
+	goto done;
+check_energy:
+	cells_op_check_energy(&vm);
+	goto done;
+check_rotation:
+	cells_op_check_rotation(&vm);
+	goto done;
+jmp_if_facing_alive_cell:
+	cells_op_jmp_if_facing_alive_cell(&vm);
+	goto done;
+jmp_if_facing_dead_cell:
+	cells_op_jmp_if_facing_dead_cell(&vm);
+	goto done;
+jmp_if_facing_void:
+	cells_op_jmp_if_facing_void(&vm);
+	goto done;
+jmp_if_facing_relative:
+	cells_op_jmp_if_facing_relative(&vm, genomeLength);
+	goto done;
+make_child:
+	cells_op_make_child(&vm, genomeLength);
+	goto done;
+
+done:
+	context->instructions++;
+
+	// the cell might have moved
+	const size_t self = vm.index;
+
+	state->currentInstruction[self] = vm.nextInstruction % genomeLength;
+	state->energy[self] -= vm.consumedEnergy;
+
+	if (state->age[self] > state->params.maxAge || state->energy[self] < 0)
+	{
+		cells_set_alive(state, self, false);
+	}
+
+	// a moved cell takes its part of the statistics along, one that attacked itself is dead already
+	if (state->alive[self])
+		cells_stats_live(&context->stats, state, self, energyBefore);
+	else
+	{
+		cells_stats_death(&context->stats, state, self, energyBefore);
+		cells_lineage_death(state, context->lineage, self);
+	}
+
+#ifdef CELLS_PROFILE
+	struct cells_opcode_profile *profile = &context->profile.opcodes[opcode];
+	const long long energy = cells_energy_units(state->energy[self]) - cells_energy_units(energyBefore);
+
+	profile->executions++;
+	profile->taken += vm.taken;
+
+	if (energy < 0)
+		profile->consumed -= energy;
+	else
+		profile->gained += energy;
+#endif
+
+	state->age[self]++;
+}
+
+#undef CELLS_KERNEL
+#undef CELLS_KERNEL_LENGTH
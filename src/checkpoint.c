@@ -0,0 +1,268 @@
+#include "checkpoint.h"
+#include "cells.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct checkpoint
+{
+	char *path;
+	unsigned keep;
+	enum cells_snapshot_format format;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+
+	// copy waiting to be written, or being written
+	struct cells_state *pending;
+	bool quit;
+	// some snapshot failed since the last checkpoint_wait()
+	bool failed;
+};
+
+// returns path with given suffix, caller frees it
+static char *checkpoint_path(const char *path, const char *suffix, const unsigned n)
+{
+	char number[16] = "";
+	if (n)
+		snprintf(number, sizeof(number), "%u", n);
+
+	const size_t size = strlen(path) + strlen(suffix) + strlen(number) + 1;
+	char *result = malloc(size);
+	assert(result);
+
+	snprintf(result, size, "%s%s%s", path, suffix, number);
+
+	return result;
+}
+
+// copies file, for file systems without hard links
+static bool checkpoint_copy(const char *from, const char *to)
+{
+	FILE *in = fopen(from, "rb");
+	FILE *out = in ? fopen(to, "wb") : NULL;
+	bool ok = in && out;
+
+	char buffer[65536];
+	size_t n;
+
+	while (ok && (n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+		ok = fwrite(buffer, 1, n, out) == n;
+
+	ok = ok && !ferror(in) && fflush(out) == 0 && fsync(fileno(out)) == 0;
+
+	if (in)
+		fclose(in);
+	if (out)
+		ok = fclose(out) == 0 && ok;
+
+	return ok;
+}
+
+/*
+	path.1 -> path.2 and so on, the oldest one is overwritten. path itself
+	is linked to path.1, not renamed, so it stays in place until the new
+	snapshot is renamed over it.
+*/
+static bool checkpoint_rotate(struct checkpoint *checkpoint)
+{
+	bool ok = true;
+
+	for (unsigned i = checkpoint->keep - 1; i > 1; i--)
+	{
+		char *from = checkpoint_path(checkpoint->path, ".", i - 1);
+		char *to = checkpoint_path(checkpoint->path, ".", i);
+
+		if (rename(from, to) != 0 && errno != ENOENT)
+		{
+			perror(from);
+			ok = false;
+		}
+
+		free(from);
+		free(to);
+	}
+
+	if (checkpoint->keep > 1)
+	{
+		char *to = checkpoint_path(checkpoint->path, ".", 1);
+
+		if (unlink(to) != 0 && errno != ENOENT)
+		{
+			perror(to);
+			ok = false;
+		}
+		else if (link(checkpoint->path, to) != 0 && errno != ENOENT && !checkpoint_copy(checkpoint->path, to))
+		{
+			perror(to);
+			ok = false;
+		}
+
+		free(to);
+	}
+
+	return ok;
+}
+
+// makes renames in the directory of path durable
+static bool checkpoint_sync_directory(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *directory = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+	assert(directory);
+
+	const int fd = open(directory, O_RDONLY | O_DIRECTORY);
+	const bool ok = fd >= 0 && fsync(fd) == 0;
+
+	if (!ok)
+		perror(directory);
+	if (fd >= 0)
+		close(fd);
+
+	free(directory);
+
+	return ok;
+}
+
+static bool checkpoint_write(struct checkpoint *checkpoint, const struct cells_state *state)
+{
+	char *tmp = checkpoint_path(checkpoint->path, ".tmp", 0);
+	bool ok = false;
+
+	FILE *f = fopen(tmp, "wb");
+	if (!f)
+		perror(tmp);
+	else
+	{
+		ok = checkpoint->format == SNAPSHOT_MAPPED ? cells_save_mapped(state, f) : cells_save(state, f);
+		// the data has to be on disk before the rename makes it visible
+		ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+		ok = fclose(f) == 0 && ok;
+
+		if (ok)
+			ok = checkpoint_rotate(checkpoint) && rename(tmp, checkpoint->path) == 0 && checkpoint_sync_directory(checkpoint->path);
+
+		if (!ok)
+			unlink(tmp);
+	}
+
+	if (!ok)
+		fprintf(stderr, "Failed to write snapshot \"%s\" at tick %llu\n", checkpoint->path, state->tick);
+
+	free(tmp);
+
+	return ok;
+}
+
+static void *checkpoint_thread(void *arg)
+{
+	struct checkpoint *checkpoint = arg;
+
+	pthread_mutex_lock(&checkpoint->lock);
+	for (;;)
+	{
+		while (!checkpoint->quit && !checkpoint->pending)
+			pthread_cond_wait(&checkpoint->wake, &checkpoint->lock);
+
+		if (!checkpoint->pending)
+			break;
+
+		struct cells_state *state = checkpoint->pending;
+		pthread_mutex_unlock(&checkpoint->lock);
+
+		const bool ok = checkpoint_write(checkpoint, state);
+		cells_quit(state);
+
+		pthread_mutex_lock(&checkpoint->lock);
+		checkpoint->failed = checkpoint->failed || !ok;
+		checkpoint->pending = NULL;
+		pthread_cond_broadcast(&checkpoint->idle);
+	}
+	pthread_mutex_unlock(&checkpoint->lock);
+
+	return NULL;
+}
+
+struct checkpoint *checkpoint_create(const char *path, const unsigned keep, const enum cells_snapshot_format format)
+{
+	assert(path && keep > 0);
+
+	struct checkpoint *checkpoint = calloc(1, sizeof(struct checkpoint));
+	assert(checkpoint);
+
+	checkpoint->path = strdup(path);
+	checkpoint->keep = keep;
+	checkpoint->format = format;
+	assert(checkpoint->path);
+
+	assert(pthread_mutex_init(&checkpoint->lock, NULL) == 0);
+	assert(pthread_cond_init(&checkpoint->wake, NULL) == 0);
+	assert(pthread_cond_init(&checkpoint->idle, NULL) == 0);
+	assert(pthread_create(&checkpoint->thread, NULL, checkpoint_thread, checkpoint) == 0);
+
+	return checkpoint;
+}
+
+bool checkpoint_destroy(struct checkpoint *checkpoint)
+{
+	if (!checkpoint)
+		return true;
+
+	// a pending snapshot is still written before the thread quits
+	pthread_mutex_lock(&checkpoint->lock);
+	checkpoint->quit = true;
+	pthread_cond_signal(&checkpoint->wake);
+	pthread_mutex_unlock(&checkpoint->lock);
+
+	pthread_join(checkpoint->thread, NULL);
+
+	const bool ok = !checkpoint->failed;
+
+	pthread_cond_destroy(&checkpoint->idle);
+	pthread_cond_destroy(&checkpoint->wake);
+	pthread_mutex_destroy(&checkpoint->lock);
+
+	free(checkpoint->path);
+	free(checkpoint);
+
+	return ok;
+}
+
+bool checkpoint_start(struct checkpoint *checkpoint, const struct cells_state *state)
+{
+	pthread_mutex_lock(&checkpoint->lock);
+
+	const bool busy = checkpoint->pending != NULL;
+	if (!busy)
+	{
+		checkpoint->pending = cells_clone(state);
+		pthread_cond_signal(&checkpoint->wake);
+	}
+
+	pthread_mutex_unlock(&checkpoint->lock);
+
+	return !busy;
+}
+
+bool checkpoint_wait(struct checkpoint *checkpoint)
+{
+	pthread_mutex_lock(&checkpoint->lock);
+
+	while (checkpoint->pending)
+		pthread_cond_wait(&checkpoint->idle, &checkpoint->lock);
+
+	const bool ok = !checkpoint->failed;
+	checkpoint->failed = false;
+
+	pthread_mutex_unlock(&checkpoint->lock);
+
+	return ok;
+}
@@ -0,0 +1,35 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include "cells.h"
+
+/*
+	Background snapshot writer.
+	The state is copied with cells_clone() on the calling thread, which
+	takes a memcpy of the arrays, the file is written by a separate thread.
+	Every snapshot goes to path.tmp first and is renamed over path once
+	it's synced to disk, so path is always a complete snapshot. Older
+	snapshots are rotated to path.1 .. path.<keep - 1>, the current one
+	is hard linked to path.1 before the rename, so path is never missing.
+	The directory is synced after the renames.
+*/
+struct checkpoint;
+
+// keep is the number of snapshots kept on disk, at least 1
+struct checkpoint *checkpoint_create(const char *path, const unsigned keep, const enum cells_snapshot_format format);
+
+// waits for the pending snapshot, returns false if any snapshot failed
+bool checkpoint_destroy(struct checkpoint *checkpoint);
+
+/*
+	Starts writing a snapshot of the state, doesn't wait for the disk.
+	If the previous snapshot is still being written, this one is skipped
+	and false is returned.
+*/
+bool checkpoint_start(struct checkpoint *checkpoint, const struct cells_state *state);
+
+// blocks until the pending snapshot is written, returns false if any snapshot failed since the last call
+bool checkpoint_wait(struct checkpoint *checkpoint);
+
+#endif
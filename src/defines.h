@@ -6,9 +6,23 @@
 #define SIMULATION_WIDTH 64
 #define SIMULATION_HEIGHT 64
 
+// preferred tile edge for the parallel tick
+#define TILE_SIZE 64
+
+// cells sharing one change version ( see cells_state.spanVersions )
+#define SPAN_SIZE 16
+
 #define CELL_WIDTH 12
 #define CELL_HEIGHT 12
 
+// percent of the world filled with cells at start
+#define START_DENSITY 20
+
+// genomes are stored with room for that many instructions, packed_instruction keeps branches in 5 bits
+#define GENOME_MAX_LENGTH 32
+
+// defaults of struct cells_params, which can be changed without a rebuild
+
 // N times from 100, mutation will happen
 #define MUTATION_PERCENT 25
 
@@ -0,0 +1,76 @@
+#include "frames.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+// set in middle, while the frame there is newer than the reader's one
+#define FRAMES_FRESH 4
+#define FRAMES_INDEX 3
+
+struct frames
+{
+	struct frame frames[3];
+
+	// index of the frame between writer and reader, with FRAMES_FRESH
+	unsigned middle;
+	// owned by the writer
+	unsigned back;
+	// owned by the reader
+	unsigned front;
+};
+
+struct frames *frames_create(const unsigned width, const unsigned height)
+{
+	struct frames *frames = calloc(1, sizeof(struct frames));
+	assert(frames);
+
+	for (int i = 0; i < 3; i++)
+	{
+		frames->frames[i].pitch = (size_t)width * sizeof(uint32_t);
+		frames->frames[i].pixels = calloc((size_t)width * height, sizeof(uint32_t));
+		assert(frames->frames[i].pixels);
+	}
+
+	frames->front = 0;
+	frames->middle = 1;
+	frames->back = 2;
+
+	return frames;
+}
+
+void frames_destroy(struct frames *frames)
+{
+	if (!frames)
+		return;
+
+	for (int i = 0; i < 3; i++)
+		free(frames->frames[i].pixels);
+
+	free(frames);
+}
+
+struct frame *frames_back(struct frames *frames)
+{
+	return &frames->frames[frames->back];
+}
+
+void frames_publish(struct frames *frames)
+{
+	// release makes the pixels visible to the reader, acquire gets back the frame it let go of
+	frames->back = __atomic_exchange_n(&frames->middle, frames->back | FRAMES_FRESH, __ATOMIC_ACQ_REL) & FRAMES_INDEX;
+}
+
+bool frames_pending(struct frames *frames)
+{
+	return __atomic_load_n(&frames->middle, __ATOMIC_ACQUIRE) & FRAMES_FRESH;
+}
+
+const struct frame *frames_acquire(struct frames *frames)
+{
+	if (!(__atomic_load_n(&frames->middle, __ATOMIC_ACQUIRE) & FRAMES_FRESH))
+		return NULL;
+
+	frames->front = __atomic_exchange_n(&frames->middle, frames->front, __ATOMIC_ACQ_REL) & FRAMES_INDEX;
+
+	return &frames->frames[frames->front];
+}
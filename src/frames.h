@@ -0,0 +1,47 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct frame
+{
+	// width x height pixels, rows are pitch bytes apart
+	uint32_t *pixels;
+	size_t pitch;
+	// tick of the simulation the frame shows
+	unsigned long long tick;
+
+	// kept by the writer, to redraw only what changed since the frame was drawn
+	unsigned long long version;
+	unsigned epoch;
+};
+
+/*
+	Lock-free triple buffer of frames, for one writer and one reader.
+	The writer fills the back frame and publishes it, which swaps it
+	with the middle one. The reader swaps the middle frame with its front
+	one whenever a new frame was published. Neither side ever waits, and
+	each of them only touches the frame it owns, so every frame the
+	reader gets is complete.
+*/
+struct frames;
+
+struct frames *frames_create(const unsigned width, const unsigned height);
+
+void frames_destroy(struct frames *frames);
+
+// writer: frame to draw the next frame into
+struct frame *frames_back(struct frames *frames);
+
+// writer: makes the back frame the newest one, replacing the previous one, if the reader didn't take it
+void frames_publish(struct frames *frames);
+
+// writer: true while the newest frame wasn't taken by the reader yet
+bool frames_pending(struct frames *frames);
+
+// reader: takes the newest frame, returns NULL if nothing was published since the last call
+const struct frame *frames_acquire(struct frames *frames);
+
+#endif
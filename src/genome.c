@@ -0,0 +1,288 @@
+#include "genome.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// first size of the hash table, it doubles when half full
+#define GENOME_TABLE_SIZE 1024
+
+uint64_t genome_hash(const packed_instruction *instructions)
+{
+	uint64_t hash = 0;
+
+	// two instructions at a time
+	for (int i = 0; i < GENOME_MAX_LENGTH; i += 2)
+	{
+		uint64_t pair = instructions[i];
+		if (i + 1 < GENOME_MAX_LENGTH)
+			pair |= (uint64_t)instructions[i + 1] << 32;
+
+		hash = util_hash64(hash ^ pair) + i;
+	}
+
+	return hash;
+}
+
+size_t genome_pool_block_size(const uint32_t capacity)
+{
+	const size_t chunks = ((size_t)capacity + GENOME_CHUNK_SIZE) / GENOME_CHUNK_SIZE;
+
+	return chunks * GENOME_CHUNK_SIZE * sizeof(struct genome_entry);
+}
+
+// makes a pool over a block of whole chunks
+static struct genome_pool *genome_pool_new(struct genome_entry *block, const size_t blockSize, const size_t mappingSize)
+{
+	struct genome_pool *pool = calloc(1, sizeof(struct genome_pool));
+	assert(pool);
+
+	pool->chunks = calloc(GENOME_CHUNKS, sizeof(*pool->chunks));
+	assert(pool->chunks);
+
+	pool->block = block;
+	pool->blockChunks = blockSize / sizeof(struct genome_entry) / GENOME_CHUNK_SIZE;
+	pool->mappingSize = mappingSize;
+	pool->capacity = pool->blockChunks * GENOME_CHUNK_SIZE - 1;
+
+	for (uint32_t i = 0; i < pool->blockChunks; i++)
+		pool->chunks[i] = block + (size_t)i * GENOME_CHUNK_SIZE;
+
+	pool->freeList = GENOME_NONE;
+	block[GENOME_NONE].used = true;
+
+	pthread_mutex_init(&pool->lock, NULL);
+
+	return pool;
+}
+
+struct genome_pool *genome_pool_create(const uint32_t capacity)
+{
+	assert(capacity < UINT32_MAX);
+
+	const size_t blockSize = genome_pool_block_size(capacity);
+
+	// calloc'ed memory is only backed once it's touched, so unused entries cost nothing
+	struct genome_entry *block = calloc(1, blockSize);
+	assert(block);
+
+	struct genome_pool *pool = genome_pool_new(block, blockSize, 0);
+	pool->tableSize = GENOME_TABLE_SIZE;
+	pool->table = calloc(pool->tableSize, sizeof(*pool->table));
+	assert(pool->table);
+
+	pool->top = 1;
+
+	return pool;
+}
+
+// puts handle into the hash table, which has a free bucket
+static void genome_pool_insert(struct genome_pool *pool, const genome_handle handle);
+
+struct genome_pool *genome_pool_map(struct genome_entry *block, const size_t mappingSize, const uint32_t top)
+{
+	assert(mappingSize % (GENOME_CHUNK_SIZE * sizeof(struct genome_entry)) == 0);
+	assert(top > 0 && top <= mappingSize / sizeof(struct genome_entry));
+
+	struct genome_pool *pool = genome_pool_new(block, mappingSize, mappingSize);
+	pool->top = top;
+
+	for (genome_handle handle = 1; handle < top; handle++)
+		pool->count += block[handle].used;
+
+	pool->tableSize = GENOME_TABLE_SIZE;
+	while (pool->count * 2 > pool->tableSize)
+		pool->tableSize *= 2;
+
+	pool->table = calloc(pool->tableSize, sizeof(*pool->table));
+	assert(pool->table);
+
+	// going down, so the free list hands out low handles first
+	for (genome_handle handle = top - 1; handle > GENOME_NONE; handle--)
+	{
+		if (block[handle].used)
+			genome_pool_insert(pool, handle);
+		else
+		{
+			block[handle].nextFree = pool->freeList;
+			pool->freeList = handle;
+		}
+	}
+
+	return pool;
+}
+
+void genome_pool_destroy(struct genome_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_destroy(&pool->lock);
+
+	for (size_t i = pool->blockChunks; i < GENOME_CHUNKS && pool->chunks[i]; i++)
+		free(pool->chunks[i]);
+
+	if (pool->mappingSize)
+		munmap(pool->block, pool->mappingSize);
+	else
+		free(pool->block);
+	free(pool->chunks);
+	free(pool->table);
+	free(pool);
+}
+
+static void genome_pool_insert(struct genome_pool *pool, const genome_handle handle)
+{
+	const size_t mask = pool->tableSize - 1;
+	size_t bucket = genome_pool_entry(pool, handle)->hash & mask;
+
+	while (pool->table[bucket] != GENOME_NONE)
+		bucket = (bucket + 1) & mask;
+
+	pool->table[bucket] = handle;
+}
+
+static void genome_pool_grow(struct genome_pool *pool)
+{
+	genome_handle *old = pool->table;
+	const size_t oldSize = pool->tableSize;
+
+	pool->tableSize *= 2;
+	pool->table = calloc(pool->tableSize, sizeof(*pool->table));
+	assert(pool->table);
+
+	for (size_t i = 0; i < oldSize; i++)
+	{
+		if (old[i] != GENOME_NONE)
+			genome_pool_insert(pool, old[i]);
+	}
+
+	free(old);
+}
+
+// takes an entry off the free list, or the next never used one
+static genome_handle genome_pool_allocate(struct genome_pool *pool)
+{
+	if (pool->freeList != GENOME_NONE)
+	{
+		const genome_handle handle = pool->freeList;
+		pool->freeList = genome_pool_entry(pool, handle)->nextFree;
+		return handle;
+	}
+
+	if (pool->top > pool->capacity)
+	{
+		// another chunk, the entries in use stay where they are
+		assert(pool->top < UINT32_MAX);
+
+		struct genome_entry **chunk = &pool->chunks[pool->top >> GENOME_CHUNK_SHIFT];
+		*chunk = calloc(GENOME_CHUNK_SIZE, sizeof(struct genome_entry));
+		assert(*chunk);
+
+		pool->capacity += GENOME_CHUNK_SIZE;
+	}
+
+	return pool->top++;
+}
+
+genome_handle genome_pool_intern(struct genome_pool *pool, const packed_instruction *instructions)
+{
+	const uint64_t hash = genome_hash(instructions);
+
+	pthread_mutex_lock(&pool->lock);
+
+	const size_t mask = pool->tableSize - 1;
+
+	for (size_t bucket = hash & mask; pool->table[bucket] != GENOME_NONE; bucket = (bucket + 1) & mask)
+	{
+		const genome_handle handle = pool->table[bucket];
+		struct genome_entry *entry = genome_pool_entry(pool, handle);
+
+		if (entry->hash == hash && memcmp(entry->instructions, instructions, sizeof(entry->instructions)) == 0)
+		{
+			// may bring back an entry, whose last holder is about to free it
+			__atomic_fetch_add(&entry->refs, 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&pool->lock);
+			return handle;
+		}
+	}
+
+	const genome_handle handle = genome_pool_allocate(pool);
+	struct genome_entry *entry = genome_pool_entry(pool, handle);
+
+	memcpy(entry->instructions, instructions, sizeof(entry->instructions));
+
+	for (int i = 0; i < GENOME_MAX_LENGTH; i++)
+		entry->opcodes[i] = genome_command(instructions[i]);
+
+	entry->hash = hash;
+	entry->refs = 1;
+	entry->used = true;
+	pool->count++;
+
+	if (pool->count * 2 > pool->tableSize)
+		genome_pool_grow(pool);
+
+	genome_pool_insert(pool, handle);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return handle;
+}
+
+// takes handle out of the hash table, shifting back entries which probed past it
+static void genome_pool_remove(struct genome_pool *pool, const genome_handle handle)
+{
+	const size_t mask = pool->tableSize - 1;
+	size_t hole = genome_pool_entry(pool, handle)->hash & mask;
+
+	while (pool->table[hole] != handle)
+		hole = (hole + 1) & mask;
+
+	for (size_t bucket = (hole + 1) & mask; pool->table[bucket] != GENOME_NONE; bucket = (bucket + 1) & mask)
+	{
+		const size_t home = genome_pool_entry(pool, pool->table[bucket])->hash & mask;
+
+		// entry can fill the hole, if its home bucket isn't between the hole and its bucket
+		if (((bucket - home) & mask) >= ((bucket - hole) & mask))
+		{
+			pool->table[hole] = pool->table[bucket];
+			hole = bucket;
+		}
+	}
+
+	pool->table[hole] = GENOME_NONE;
+}
+
+void genome_pool_release(struct genome_pool *pool, const genome_handle handle)
+{
+	if (handle == GENOME_NONE)
+		return;
+
+	struct genome_entry *entry = genome_pool_entry(pool, handle);
+
+	if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+
+	// someone could have interned it again, or freed it already
+	if (entry->used && __atomic_load_n(&entry->refs, __ATOMIC_RELAXED) == 0)
+	{
+		genome_pool_remove(pool, handle);
+
+		entry->used = false;
+		entry->nextFree = pool->freeList;
+		pool->freeList = handle;
+		pool->count--;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+size_t genome_pool_memory_usage(const struct genome_pool *pool)
+{
+	return sizeof(struct genome_pool) + pool->top * sizeof(struct genome_entry) + pool->tableSize * sizeof(*pool->table) +
+		   ((size_t)pool->capacity + 1) / GENOME_CHUNK_SIZE * sizeof(*pool->chunks);
+}
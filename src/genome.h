@@ -0,0 +1,270 @@
+#ifndef GENOME_H
+#define GENOME_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "defines.h"
+
+enum gen_instruction
+{
+	// do nothing
+	NOOP,
+
+	// movement
+	TURN_LEFT,
+	TURN_RIGHT,
+	MOVE_FORWARDS,
+
+	PHOTOSYNTHESIS,
+
+	// gives e energy to cell in front
+	GIVE_ENERGY,
+
+	// attacks cell in front
+	// if cell class is hunter cell, it kills the cell immediately
+	ATTACK_CELL,
+
+	// eats dead cell in front
+	RECYCLE_DEAD_CELL,
+
+	// jump to instruction b1 if cell has more than e energy
+	// otherwise, jump to instruction b2
+	CHECK_ENERGY,
+
+	// if left -> b1
+	// if right ->
+	CHECK_ROTATION,
+
+	// jump to instruction BX, if there's alive cell in front
+	JMP_IF_FACING_ALIVE_CELL,
+
+	// jump to instruction BX, if there's dead cell in front
+	JMP_IF_FACING_DEAD_CELL,
+
+	// jump to instruction BX, if facing empty space
+	JMP_IF_FACING_VOID,
+
+	// if cell's genome is at least CX% similar to other's cell genome, jumping to instruction bx
+	JMP_IF_FACING_RELATIVE,
+
+	// works, if cell has more than the reproduction energy ( see cells_params )
+	MAKE_CHILD
+};
+
+struct instruction
+{
+	enum gen_instruction command;
+
+	// those are "arguments" for main instruction
+	// opt is a boolean. in some instructions, alters it
+	// e stores energy from 0 to twice the reproduction energy, and is used in JMP_IF_LESS/JMP_IF_GREATER
+	// b1 and b2 are branches for JMP instructions
+	// b3 and b4 are branches for CHECK_ROTATION
+	// if the JMP condition is true, jumps to instruction b1
+	// otherwise, to instruction b2
+	bool opt;
+	uint8_t e;	// energy condition
+	uint8_t b1; // branch 1
+	uint8_t b2; // branch 2
+	uint8_t b3; // branch 3
+	uint8_t b4; // branch 4
+};
+
+/*
+	Instruction packed into 31 bits, a genome takes GENOME_MAX_LENGTH * 4
+	bytes. Shorter genomes are padded with zeros. Branches are kept modulo
+	32, the interpreter takes them modulo the genome length anyway, so
+	behaviour doesn't change.
+*/
+typedef uint32_t packed_instruction;
+
+#if GENOME_MAX_LENGTH > 32
+#error "packed_instruction keeps branches in 5 bits, GENOME_MAX_LENGTH can't exceed 32"
+#endif
+
+#define GENE_COMMAND_SHIFT 0
+#define GENE_OPT_SHIFT 4
+#define GENE_E_SHIFT 5
+#define GENE_B1_SHIFT 11
+#define GENE_B2_SHIFT 16
+#define GENE_B3_SHIFT 21
+#define GENE_B4_SHIFT 26
+
+#define GENE_COMMAND_MASK 0xf
+#define GENE_E_MASK 0x3f
+#define GENE_BRANCH_MASK 0x1f
+
+// bits used by packed_instruction, the rest is always zero
+#define GENE_MASK ((GENE_BRANCH_MASK << GENE_B4_SHIFT) | ((1u << GENE_B4_SHIFT) - 1))
+
+static inline packed_instruction genome_pack(const struct instruction *instruction)
+{
+	return (instruction->command & GENE_COMMAND_MASK) << GENE_COMMAND_SHIFT |
+		   (packed_instruction)instruction->opt << GENE_OPT_SHIFT |
+		   (instruction->e & GENE_E_MASK) << GENE_E_SHIFT |
+		   (instruction->b1 & GENE_BRANCH_MASK) << GENE_B1_SHIFT |
+		   (instruction->b2 & GENE_BRANCH_MASK) << GENE_B2_SHIFT |
+		   (instruction->b3 & GENE_BRANCH_MASK) << GENE_B3_SHIFT |
+		   (instruction->b4 & GENE_BRANCH_MASK) << GENE_B4_SHIFT;
+}
+
+static inline unsigned genome_command(const packed_instruction gene)
+{
+	return gene >> GENE_COMMAND_SHIFT & GENE_COMMAND_MASK;
+}
+
+static inline bool genome_opt(const packed_instruction gene)
+{
+	return gene >> GENE_OPT_SHIFT & 1;
+}
+
+static inline unsigned genome_e(const packed_instruction gene)
+{
+	return gene >> GENE_E_SHIFT & GENE_E_MASK;
+}
+
+static inline unsigned genome_b1(const packed_instruction gene)
+{
+	return gene >> GENE_B1_SHIFT & GENE_BRANCH_MASK;
+}
+
+static inline unsigned genome_b2(const packed_instruction gene)
+{
+	return gene >> GENE_B2_SHIFT & GENE_BRANCH_MASK;
+}
+
+static inline unsigned genome_b3(const packed_instruction gene)
+{
+	return gene >> GENE_B3_SHIFT & GENE_BRANCH_MASK;
+}
+
+static inline unsigned genome_b4(const packed_instruction gene)
+{
+	return gene >> GENE_B4_SHIFT & GENE_BRANCH_MASK;
+}
+
+static inline struct instruction genome_unpack(const packed_instruction gene)
+{
+	return (struct instruction){
+		.command = genome_command(gene),
+		.opt = genome_opt(gene),
+		.e = genome_e(gene),
+		.b1 = genome_b1(gene),
+		.b2 = genome_b2(gene),
+		.b3 = genome_b3(gene),
+		.b4 = genome_b4(gene),
+	};
+}
+
+// index of a genome in struct genome_pool
+typedef uint32_t genome_handle;
+
+// empty slots hold no genome, it reads as NOOPs
+#define GENOME_NONE 0
+
+// entries come in chunks of that many, a full pool gets another chunk, so entries in use never move
+#define GENOME_CHUNK_SHIFT 16
+#define GENOME_CHUNK_SIZE (1u << GENOME_CHUNK_SHIFT)
+#define GENOME_CHUNKS (((size_t)UINT32_MAX >> GENOME_CHUNK_SHIFT) + 1)
+
+struct genome_entry
+{
+	packed_instruction instructions[GENOME_MAX_LENGTH];
+	// commands packed into bytes, for fast similarity checks
+	uint8_t opcodes[GENOME_MAX_LENGTH];
+	uint64_t hash;
+
+	// number of holders, the entry is freed when it drops to zero
+	uint32_t refs;
+	// next entry in the free list, while the entry is unused
+	genome_handle nextFree;
+	bool used;
+};
+
+/*
+	Copy-on-write genome storage.
+	Every distinct genome is stored once and shared by all cells carrying
+	it, so cloning a cell only bumps a reference count. Genomes are never
+	changed in place, a mutated copy is interned as a new entry. Since
+	equal genomes always get the same handle, comparing handles is the
+	same as comparing genomes.
+	Entries never move, so they can be read without locking while their
+	holder keeps a reference. Interning and freeing take the lock, a full
+	pool gets another chunk of entries.
+*/
+struct genome_pool
+{
+	// GENOME_CHUNKS pointers, entry of a handle is chunks[handle >> GENOME_CHUNK_SHIFT][handle % GENOME_CHUNK_SIZE]
+	struct genome_entry **chunks;
+	// first blockChunks chunks are one block, later ones are calloc'ed on their own
+	struct genome_entry *block;
+	uint32_t blockChunks;
+	// size of the mmap()'ed block, 0 if it's calloc'ed
+	size_t mappingSize;
+	// handles up to capacity have an entry, entry GENOME_NONE is the empty genome
+	uint32_t capacity;
+	// entries below top were used at least once, the rest was never touched
+	uint32_t top;
+	genome_handle freeList;
+	// number of used entries
+	uint32_t count;
+
+	// hash -> handle, linear probing, GENOME_NONE marks a free bucket
+	genome_handle *table;
+	size_t tableSize;
+
+	pthread_mutex_t lock;
+};
+
+// returns hash of all genome instructions
+uint64_t genome_hash(const packed_instruction *instructions);
+
+/*
+	Creates pool with room for capacity distinct genomes, it grows past
+	that. A copy of the holders keeps its references while the original
+	interns new genomes, so it's worth starting with room for both.
+*/
+struct genome_pool *genome_pool_create(const uint32_t capacity);
+
+// returns size of a block of whole chunks, which holds capacity + 1 entries
+size_t genome_pool_block_size(const uint32_t capacity);
+
+/*
+	Creates pool over a block of entries mapped by the caller, which is
+	genome_pool_block_size() bytes. Entries below top are taken as they
+	are, the hash table and the free list are rebuilt from their used
+	flags. The mapping is released with munmap() in genome_pool_destroy().
+*/
+struct genome_pool *genome_pool_map(struct genome_entry *block, const size_t mappingSize, const uint32_t top);
+
+void genome_pool_destroy(struct genome_pool *pool);
+
+// returns handle of given genome with one reference taken, adds it if it isn't stored yet
+genome_handle genome_pool_intern(struct genome_pool *pool, const packed_instruction *instructions);
+
+// drops one reference, frees the genome when it was the last one
+void genome_pool_release(struct genome_pool *pool, const genome_handle handle);
+
+// returns number of bytes the pool has touched so far
+size_t genome_pool_memory_usage(const struct genome_pool *pool);
+
+static inline struct genome_entry *genome_pool_entry(const struct genome_pool *pool, const genome_handle handle)
+{
+	return &pool->chunks[handle >> GENOME_CHUNK_SHIFT][handle & (GENOME_CHUNK_SIZE - 1)];
+}
+
+// takes one more reference to a stored genome
+static inline void genome_pool_retain(struct genome_pool *pool, const genome_handle handle)
+{
+	if (handle != GENOME_NONE)
+		__atomic_fetch_add(&genome_pool_entry(pool, handle)->refs, 1, __ATOMIC_RELAXED);
+}
+
+static inline const struct genome_entry *genome_pool_get(const struct genome_pool *pool, const genome_handle handle)
+{
+	return genome_pool_entry(pool, handle);
+}
+
+#endif
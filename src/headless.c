@@ -0,0 +1,778 @@
+// Batch runner without SDL, for servers and scripts
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "cells.h"
+#include "checkpoint.h"
+#include "defines.h"
+#include "pool.h"
+#include "timing.h"
+#include "util.h"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int signal)
+{
+	interrupted = 1;
+}
+
+static void usage(const char *program)
+{
+	printf("Usage: %s [options]\n", program);
+	printf("  -n, --ticks N           number of ticks to run, 0 runs until interrupted ( default 1000 )\n");
+	printf("  -w, --width N           simulation width in cells ( default %d )\n", SIMULATION_WIDTH);
+	printf("  -h, --height N          simulation height in cells ( default %d )\n", SIMULATION_HEIGHT);
+	printf("  -t, --threads N         number of simulation threads ( default 1 )\n");
+	printf("  -s, --seed N            random seed ( default is current time )\n");
+	printf("      --tick-mode MODE    in-place ( default ) or once, see enum cells_tick_mode\n");
+	printf("      --relative-threshold N  equal genes needed to treat cells as relatives ( default genome length - 1 )\n");
+	printf("      --config FILE       set simulation parameters from FILE of name=value pairs, # starts a comment\n");
+	printf("  -p, --param NAME=VALUE  set simulation parameter, see cells_set_param() for names, applied in order\n");
+	printf("  -i, --stats-every N     print stats every N ticks ( default 100 )\n");
+	printf("  -o, --stats FILE        write stats to FILE instead of stdout\n");
+	printf("      --stats-format F    csv ( default ) or json, one object per line\n");
+	printf("  -S, --snapshot FILE     save the simulation to FILE after the last tick\n");
+	printf("      --snapshot-every N  also save it every N ticks in the background\n");
+	printf("      --snapshot-keep N   number of snapshots kept as FILE, FILE.1, ... ( default 3 )\n");
+	printf("      --snapshot-format F stream ( default, compact ) or mapped ( opens instantly with --resume )\n");
+	printf("  -r, --resume FILE       continue the simulation saved in FILE, instead of starting a new one\n");
+	printf("      --lineage FILE      append births and extinctions of lineages to FILE, see lineage.h\n");
+	printf("      --lineage-dump FILE print lineage log FILE as CSV and exit\n");
+	printf("      --ensemble FILE     run worlds listed in FILE at once, one per line as key=value pairs\n");
+	printf("                          ( name, seed, width, height, ticks, density, tick-mode, relative-threshold\n");
+	printf("                          or any simulation parameter ),\n");
+	printf("                          missing ones come from the options above, --threads worlds run at a time\n");
+	printf("      --worlds N          run N worlds with seeds from --seed on, instead of --ensemble\n");
+	printf("      --output DIR        directory for stats and snapshots of the worlds ( default . )\n");
+	printf("      --help              show this message\n");
+}
+
+// prints lineage log as CSV, returns false if it can't be read or is corrupted
+static bool dump_lineage(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+	{
+		perror(path);
+		return false;
+	}
+
+	const bool ok = lineage_log_dump(f, stdout);
+	fclose(f);
+
+	if (!ok)
+		fprintf(stderr, "\"%s\" is not a valid lineage log, or it's cut short\n", path);
+
+	return ok;
+}
+
+enum stats_format
+{
+	STATS_CSV,
+	STATS_JSON,
+};
+
+static const char *food_source_names[] = {
+	[FOOD_SOURCE_PHOTOSYNTHESIS] = "photosynthesis",
+	[FOOD_SOURCE_MEAT] = "meat",
+	[FOOD_SOURCE_DEAD_CELLS] = "dead_cells",
+	[FOOD_SOURCE_UNKNOWN] = "unknown",
+};
+
+static void print_stats_header(FILE *f, const enum stats_format format)
+{
+	if (format != STATS_CSV)
+		return;
+
+	fprintf(f, "tick,alive,dead,empty,alive_energy,dead_energy");
+	for (int i = 0; i <= FOOD_SOURCE_UNKNOWN; i++)
+		fprintf(f, ",food_%s", food_source_names[i]);
+	for (int i = 0; i < CELLS_AGE_BUCKETS; i++)
+		fprintf(f, ",age_%d", i);
+	fprintf(f, ",births,deaths,ticks_per_second\n");
+}
+
+// the counts are kept by the tick, printing them doesn't scan the world
+static void print_stats(FILE *f, const enum stats_format format, const struct cells_state *state, const double ticksPerSecond)
+{
+	const struct cells_stats *stats = &state->stats;
+	const double aliveEnergy = (double)stats->aliveEnergy / CELLS_ENERGY_SCALE;
+	const double deadEnergy = (double)stats->deadEnergy / CELLS_ENERGY_SCALE;
+
+	if (format == STATS_JSON)
+	{
+		fprintf(f, "{\"tick\":%llu,\"alive\":%lld,\"dead\":%lld,\"empty\":%lld,\"alive_energy\":%.2f,\"dead_energy\":%.2f,\"food\":{",
+				state->tick, stats->alive, stats->dead, stats->empty, aliveEnergy, deadEnergy);
+		for (int i = 0; i <= FOOD_SOURCE_UNKNOWN; i++)
+			fprintf(f, "%s\"%s\":%lld", i ? "," : "", food_source_names[i], stats->foodSources[i]);
+		fprintf(f, "},\"ages\":[");
+		for (int i = 0; i < CELLS_AGE_BUCKETS; i++)
+			fprintf(f, "%s%lld", i ? "," : "", stats->ages[i]);
+		fprintf(f, "],\"births\":%lld,\"deaths\":%lld,\"ticks_per_second\":%.1f}\n", stats->births, stats->deaths, ticksPerSecond);
+	}
+	else
+	{
+		fprintf(f, "%llu,%lld,%lld,%lld,%.2f,%.2f", state->tick, stats->alive, stats->dead, stats->empty, aliveEnergy, deadEnergy);
+		for (int i = 0; i <= FOOD_SOURCE_UNKNOWN; i++)
+			fprintf(f, ",%lld", stats->foodSources[i]);
+		for (int i = 0; i < CELLS_AGE_BUCKETS; i++)
+			fprintf(f, ",%lld", stats->ages[i]);
+		fprintf(f, ",%lld,%lld,%.1f\n", stats->births, stats->deaths, ticksPerSecond);
+	}
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+	Ensemble runs many independent worlds at once. Every world is one task
+	of a thread pool, a thread which is done with a world takes the next
+	one, so worlds of different sizes keep all threads busy. Each world has
+	its own parameters and seed, so its own random stream, and writes its
+	own stats and snapshots to DIR/NAME.csv ( or .jsonl ) and DIR/NAME.bin.
+*/
+struct world
+{
+	char name[64];
+	uint64_t seed;
+	unsigned width;
+	unsigned height;
+	unsigned density;
+	// 0 runs until interrupted
+	unsigned long long ticks;
+	enum cells_tick_mode tickMode;
+	// -1 keeps the default of cells_init()
+	int relativeThreshold;
+	struct cells_params params;
+
+	// filled in by the run
+	bool ok;
+	unsigned long long lastTick;
+	unsigned alive;
+	double seconds;
+};
+
+struct ensemble
+{
+	struct world *worlds;
+	unsigned count;
+	// worlds in the order they're started, the longest ones first, so no thread ends up with a big one alone
+	unsigned *order;
+
+	const char *output;
+	unsigned long long statsEvery;
+	enum stats_format statsFormat;
+	unsigned long long snapshotEvery;
+	unsigned snapshotKeep;
+	enum cells_snapshot_format snapshotFormat;
+};
+
+// returns DIR/NAME.EXTENSION, caller frees it
+static char *ensemble_path(const char *dir, const char *name, const char *extension)
+{
+	const size_t size = strlen(dir) + strlen(name) + strlen(extension) + 2;
+	char *path = malloc(size);
+	assert(path);
+
+	snprintf(path, size, "%s/%s%s", dir, name, extension);
+
+	return path;
+}
+
+// fills world from a line of key=value pairs, keeping defaults of the missing ones
+static bool ensemble_parse_world(char *line, struct world *world, const char *path, const unsigned lineNumber)
+{
+	char *saved;
+
+	for (char *pair = strtok_r(line, " \t\r\n", &saved); pair; pair = strtok_r(NULL, " \t\r\n", &saved))
+	{
+		char *value = strchr(pair, '=');
+
+		if (!value)
+		{
+			fprintf(stderr, "%s:%u: expected key=value, got '%s'\n", path, lineNumber, pair);
+			return false;
+		}
+
+		*value++ = '\0';
+
+		if (!strcmp(pair, "name"))
+		{
+			// names become file names
+			if (!*value || strlen(value) >= sizeof(world->name) || strchr(value, '/'))
+			{
+				fprintf(stderr, "%s:%u: invalid name '%s'\n", path, lineNumber, value);
+				return false;
+			}
+
+			strcpy(world->name, value);
+		}
+		else if (!strcmp(pair, "seed"))
+			world->seed = util_parse_number("seed", value, 0, UINT64_MAX);
+		else if (!strcmp(pair, "width"))
+			world->width = util_parse_number("width", value, 1, 65535);
+		else if (!strcmp(pair, "height"))
+			world->height = util_parse_number("height", value, 1, 65535);
+		else if (!strcmp(pair, "ticks"))
+			world->ticks = util_parse_number("ticks", value, 0, UINT64_MAX);
+		else if (!strcmp(pair, "density"))
+			world->density = util_parse_number("density", value, 0, 100);
+		else if (!strcmp(pair, "tick-mode"))
+		{
+			if (!cells_parse_tick_mode(value, &world->tickMode))
+			{
+				fprintf(stderr, "%s:%u: unknown tick mode '%s'\n", path, lineNumber, value);
+				return false;
+			}
+		}
+		else if (!strcmp(pair, "relative-threshold"))
+			world->relativeThreshold = util_parse_number("relative-threshold", value, 0, GENOME_MAX_LENGTH);
+		else if (!cells_set_param(&world->params, pair, value))
+		{
+			fprintf(stderr, "%s:%u: unknown key '%s'\n", path, lineNumber, pair);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// reads worlds from path, empty lines and lines starting with # are skipped, returns false on errors
+static bool ensemble_load(struct ensemble *ensemble, const char *path, const struct world *defaults)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+	{
+		perror(path);
+		return false;
+	}
+
+	char line[1024];
+	unsigned lineNumber = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), f))
+	{
+		lineNumber++;
+
+		const char *start = line + strspn(line, " \t\r\n");
+		if (*start == '\0' || *start == '#')
+			continue;
+
+		ensemble->worlds = realloc(ensemble->worlds, (ensemble->count + 1) * sizeof(struct world));
+		assert(ensemble->worlds);
+
+		// every world gets its own seed, unless the line says otherwise
+		struct world *world = &ensemble->worlds[ensemble->count];
+		*world = *defaults;
+		world->seed = defaults->seed + ensemble->count;
+		snprintf(world->name, sizeof(world->name), "world-%u", ensemble->count);
+
+		ok = ensemble_parse_world(line, world, path, lineNumber);
+		ensemble->count++;
+	}
+
+	fclose(f);
+
+	return ok;
+}
+
+static void ensemble_run_world(void *ctx, const unsigned task, const unsigned worker)
+{
+	const struct ensemble *ensemble = ctx;
+	struct world *world = &ensemble->worlds[ensemble->order[task]];
+	const double start = now();
+
+	char *statsPath = ensemble_path(ensemble->output, world->name, ensemble->statsFormat == STATS_JSON ? ".jsonl" : ".csv");
+	char *snapshotPath = ensemble_path(ensemble->output, world->name, ".bin");
+
+	FILE *stats = fopen(statsPath, "w");
+	if (!stats)
+	{
+		perror(statsPath);
+		free(statsPath);
+		free(snapshotPath);
+		return;
+	}
+
+	// worlds are the parallel tasks, each of them is updated by one thread
+	struct cells_state *state = cells_init(world->width, world->height, world->seed, &world->params, world->density);
+
+	state->tickMode = world->tickMode;
+	if (world->relativeThreshold >= 0)
+		state->relativeThreshold = world->relativeThreshold;
+
+	struct checkpoint *checkpoint = checkpoint_create(snapshotPath, ensemble->snapshotKeep, ensemble->snapshotFormat);
+
+	print_stats_header(stats, ensemble->statsFormat);
+
+	double statsStart = start;
+	unsigned long long lastTick = 0;
+	// the last tick already has a snapshot, the final one is skipped then
+	bool saved = false;
+
+	while ((world->ticks == 0 || state->tick < world->ticks) && !interrupted)
+	{
+		cells_update_state(state);
+		saved = false;
+
+		if (state->tick % ensemble->statsEvery == 0)
+		{
+			const double end = now();
+
+			print_stats(stats, ensemble->statsFormat, state, (state->tick - lastTick) / (end - statsStart));
+
+			statsStart = end;
+			lastTick = state->tick;
+		}
+
+		if (ensemble->snapshotEvery && state->tick % ensemble->snapshotEvery == 0)
+			saved = checkpoint_start(checkpoint, state);
+	}
+
+	bool ok = checkpoint_wait(checkpoint);
+	if (!saved)
+		checkpoint_start(checkpoint, state);
+	ok = checkpoint_destroy(checkpoint) && ok;
+	ok = !ferror(stats) && ok;
+	ok = fclose(stats) == 0 && ok;
+
+	world->ok = ok;
+	world->lastTick = state->tick;
+	world->alive = cells_count_alive_cells(state);
+	world->seconds = now() - start;
+
+	fprintf(stderr, "World \"%s\" stopped at tick %llu with %u alive cells after %.1f s\n", world->name, world->lastTick, world->alive,
+			world->seconds);
+
+	cells_quit(state);
+	free(statsPath);
+	free(snapshotPath);
+}
+
+static double ensemble_cost(const struct world *world)
+{
+	// worlds running until interrupted go first
+	return world->ticks ? (double)world->width * world->height * world->ticks : INFINITY;
+}
+
+// runs all worlds, returns true if all of them wrote their stats and snapshots
+static bool ensemble_run(struct ensemble *ensemble, const unsigned threads)
+{
+	ensemble->order = malloc(ensemble->count * sizeof(unsigned));
+	assert(ensemble->order);
+
+	// insertion sort keeps worlds of the same cost in the order they were given
+	for (unsigned i = 0; i < ensemble->count; i++)
+	{
+		unsigned j = i;
+
+		for (; j > 0 && ensemble_cost(&ensemble->worlds[ensemble->order[j - 1]]) < ensemble_cost(&ensemble->worlds[i]); j--)
+			ensemble->order[j] = ensemble->order[j - 1];
+
+		ensemble->order[j] = i;
+	}
+
+	fprintf(stderr, "Running %u worlds on %u threads\n", ensemble->count, threads);
+
+	struct pool *pool = pool_create(threads);
+	pool_run(pool, ensemble_run_world, ensemble, ensemble->count);
+	pool_destroy(pool);
+
+	bool ok = true;
+	for (unsigned i = 0; i < ensemble->count; i++)
+		ok = ensemble->worlds[i].ok && ok;
+
+	free(ensemble->order);
+
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long ticks = 1000;
+	unsigned width = SIMULATION_WIDTH;
+	unsigned height = SIMULATION_HEIGHT;
+	unsigned threads = 1;
+	uint64_t seed = time(NULL);
+	enum cells_tick_mode tickMode = TICK_IN_PLACE;
+	// -1 keeps the default of cells_init()
+	int relativeThreshold = -1;
+	struct cells_params params = cells_default_params();
+	bool paramsSet = false;
+	unsigned long long statsEvery = 100;
+	enum stats_format statsFormat = STATS_CSV;
+	unsigned long long snapshotEvery = 0;
+	unsigned snapshotKeep = 3;
+	enum cells_snapshot_format snapshotFormat = SNAPSHOT_STREAM;
+	const char *resumePath = NULL;
+	const char *statsPath = NULL;
+	const char *snapshotPath = NULL;
+	const char *ensemblePath = NULL;
+	const char *lineagePath = NULL;
+	const char *outputPath = ".";
+	unsigned worlds = 0;
+
+	enum
+	{
+		OPTION_HELP = 256,
+		OPTION_SNAPSHOT_EVERY,
+		OPTION_SNAPSHOT_KEEP,
+		OPTION_SNAPSHOT_FORMAT,
+		OPTION_TICK_MODE,
+		OPTION_RELATIVE_THRESHOLD,
+		OPTION_STATS_FORMAT,
+		OPTION_ENSEMBLE,
+		OPTION_WORLDS,
+		OPTION_OUTPUT,
+		OPTION_CONFIG,
+		OPTION_LINEAGE,
+		OPTION_LINEAGE_DUMP,
+	};
+
+	const struct option options[] = {
+		{"ticks", required_argument, NULL, 'n'},
+		{"width", required_argument, NULL, 'w'},
+		{"height", required_argument, NULL, 'h'},
+		{"threads", required_argument, NULL, 't'},
+		{"seed", required_argument, NULL, 's'},
+		{"tick-mode", required_argument, NULL, OPTION_TICK_MODE},
+		{"relative-threshold", required_argument, NULL, OPTION_RELATIVE_THRESHOLD},
+		{"config", required_argument, NULL, OPTION_CONFIG},
+		{"param", required_argument, NULL, 'p'},
+		{"stats-every", required_argument, NULL, 'i'},
+		{"stats", required_argument, NULL, 'o'},
+		{"stats-format", required_argument, NULL, OPTION_STATS_FORMAT},
+		{"snapshot", required_argument, NULL, 'S'},
+		{"snapshot-every", required_argument, NULL, OPTION_SNAPSHOT_EVERY},
+		{"snapshot-keep", required_argument, NULL, OPTION_SNAPSHOT_KEEP},
+		{"snapshot-format", required_argument, NULL, OPTION_SNAPSHOT_FORMAT},
+		{"resume", required_argument, NULL, 'r'},
+		{"lineage", required_argument, NULL, OPTION_LINEAGE},
+		{"lineage-dump", required_argument, NULL, OPTION_LINEAGE_DUMP},
+		{"ensemble", required_argument, NULL, OPTION_ENSEMBLE},
+		{"worlds", required_argument, NULL, OPTION_WORLDS},
+		{"output", required_argument, NULL, OPTION_OUTPUT},
+		{"help", no_argument, NULL, OPTION_HELP},
+		{0},
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "n:w:h:t:s:p:i:o:S:r:", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			ticks = util_parse_number("--ticks", optarg, 0, UINT64_MAX);
+			break;
+		case 'w':
+			width = util_parse_number("--width", optarg, 1, 65535);
+			break;
+		case 'h':
+			height = util_parse_number("--height", optarg, 1, 65535);
+			break;
+		case 't':
+			threads = util_parse_number("--threads", optarg, 1, 1024);
+			break;
+		case 's':
+			seed = util_parse_number("--seed", optarg, 0, UINT64_MAX);
+			break;
+		case 'i':
+			statsEvery = util_parse_number("--stats-every", optarg, 1, UINT64_MAX);
+			break;
+		case 'o':
+			statsPath = optarg;
+			break;
+		case OPTION_STATS_FORMAT:
+			if (!strcmp(optarg, "csv"))
+				statsFormat = STATS_CSV;
+			else if (!strcmp(optarg, "json"))
+				statsFormat = STATS_JSON;
+			else
+			{
+				fprintf(stderr, "unknown stats format '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			snapshotPath = optarg;
+			break;
+		case OPTION_SNAPSHOT_EVERY:
+			snapshotEvery = util_parse_number("--snapshot-every", optarg, 1, UINT64_MAX);
+			break;
+		case OPTION_SNAPSHOT_KEEP:
+			snapshotKeep = util_parse_number("--snapshot-keep", optarg, 1, 1000);
+			break;
+		case OPTION_SNAPSHOT_FORMAT:
+			if (!cells_parse_snapshot_format(optarg, &snapshotFormat))
+			{
+				fprintf(stderr, "unknown snapshot format '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			resumePath = optarg;
+			break;
+		case OPTION_LINEAGE:
+			lineagePath = optarg;
+			break;
+		case OPTION_LINEAGE_DUMP:
+			return dump_lineage(optarg) ? EXIT_SUCCESS : EXIT_FAILURE;
+		case OPTION_TICK_MODE:
+			if (!cells_parse_tick_mode(optarg, &tickMode))
+			{
+				fprintf(stderr, "unknown tick mode '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPTION_RELATIVE_THRESHOLD:
+			relativeThreshold = util_parse_number("--relative-threshold", optarg, 0, GENOME_MAX_LENGTH);
+			break;
+		case OPTION_CONFIG:
+			if (!cells_load_params(&params, optarg))
+				return EXIT_FAILURE;
+			paramsSet = true;
+			break;
+		case 'p':
+			if (!cells_parse_param(&params, optarg))
+			{
+				fprintf(stderr, "expected NAME=VALUE of a known parameter for --param, got '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			paramsSet = true;
+			break;
+		case OPTION_ENSEMBLE:
+			ensemblePath = optarg;
+			break;
+		case OPTION_WORLDS:
+			worlds = util_parse_number("--worlds", optarg, 1, 1000000);
+			break;
+		case OPTION_OUTPUT:
+			outputPath = optarg;
+			break;
+		case OPTION_HELP:
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// stop cleanly on ^C, so the final snapshot still gets written
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	if (ensemblePath || worlds)
+	{
+		if (ensemblePath && worlds)
+		{
+			fprintf(stderr, "--ensemble and --worlds can't be used together\n");
+			return EXIT_FAILURE;
+		}
+
+		if (resumePath || statsPath || snapshotPath || lineagePath)
+		{
+			fprintf(stderr, "worlds of an ensemble write to --output, --resume, --stats, --snapshot and --lineage don't apply\n");
+			return EXIT_FAILURE;
+		}
+
+		const struct world defaults = {
+			.seed = seed,
+			.width = width,
+			.height = height,
+			.density = START_DENSITY,
+			.ticks = ticks,
+			.tickMode = tickMode,
+			.relativeThreshold = relativeThreshold,
+			.params = params,
+		};
+
+		struct ensemble ensemble = {
+			.output = outputPath,
+			.statsEvery = statsEvery,
+			.statsFormat = statsFormat,
+			.snapshotEvery = snapshotEvery,
+			.snapshotKeep = snapshotKeep,
+			.snapshotFormat = snapshotFormat,
+		};
+
+		if (ensemblePath && !ensemble_load(&ensemble, ensemblePath, &defaults))
+		{
+			free(ensemble.worlds);
+			return EXIT_FAILURE;
+		}
+
+		for (unsigned i = 0; i < worlds; i++)
+		{
+			ensemble.worlds = realloc(ensemble.worlds, (i + 1) * sizeof(struct world));
+			assert(ensemble.worlds);
+
+			ensemble.worlds[i] = defaults;
+			ensemble.worlds[i].seed = seed + i;
+			snprintf(ensemble.worlds[i].name, sizeof(ensemble.worlds[i].name), "world-%u", i);
+			ensemble.count++;
+		}
+
+		const bool ok = ensemble_run(&ensemble, threads);
+		free(ensemble.worlds);
+
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (resumePath && paramsSet)
+	{
+		fprintf(stderr, "parameters of a resumed simulation come from the snapshot, --config and --param don't apply\n");
+		return EXIT_FAILURE;
+	}
+
+	if (snapshotEvery && !snapshotPath)
+	{
+		fprintf(stderr, "--snapshot-every needs --snapshot\n");
+		return EXIT_FAILURE;
+	}
+
+	FILE *stats = stdout;
+	if (statsPath && !(stats = fopen(statsPath, "w")))
+	{
+		perror(statsPath);
+		return EXIT_FAILURE;
+	}
+
+	// a resumed run appends to the log of the earlier one
+	struct lineage_log *lineage = NULL;
+	if (lineagePath && !(lineage = lineage_log_open(lineagePath)))
+	{
+		perror(lineagePath);
+		return EXIT_FAILURE;
+	}
+
+	struct cells_state *state;
+
+	if (resumePath)
+	{
+		// size, seed and parameters come from the snapshot
+		FILE *f = fopen(resumePath, "rb");
+		if (!f)
+		{
+			perror(resumePath);
+			return EXIT_FAILURE;
+		}
+
+		state = cells_open(f);
+		fclose(f);
+
+		if (!state)
+		{
+			fprintf(stderr, "\"%s\" is not a valid snapshot\n", resumePath);
+			return EXIT_FAILURE;
+		}
+
+		fprintf(stderr, "Resuming \"%s\" at tick %llu, seed %llu, %ux%u, %u threads\n", resumePath, state->tick,
+				(unsigned long long)state->seed, state->width, state->height, threads);
+	}
+	else
+	{
+		fprintf(stderr, "Seed %llu, %ux%u, %u threads\n", (unsigned long long)seed, width, height, threads);
+
+		state = cells_init(width, height, seed, &params, START_DENSITY);
+		state->tickMode = tickMode;
+		if (relativeThreshold >= 0)
+			state->relativeThreshold = relativeThreshold;
+	}
+
+	cells_set_threads(state, threads);
+	cells_set_lineage_log(state, lineage);
+
+	// ticks are counted from the resumed one
+	const unsigned long long lastTickToRun = ticks ? state->tick + ticks : 0;
+
+	struct checkpoint *checkpoint = snapshotPath ? checkpoint_create(snapshotPath, snapshotKeep, snapshotFormat) : NULL;
+
+	print_stats_header(stats, statsFormat);
+
+#ifdef CELLS_PROFILE
+	struct cells_profile profile = {0};
+#endif
+
+	bool ok = true;
+	double start = now();
+	unsigned long long lastTick = state->tick;
+	// the last tick already has a snapshot, the final one is skipped then
+	bool saved = false;
+
+	while ((ticks == 0 || state->tick < lastTickToRun) && !interrupted)
+	{
+		TIMING_BEGIN(TIMING_TICK);
+		cells_update_state(state);
+		TIMING_END(TIMING_TICK);
+
+#ifdef CELLS_PROFILE
+		cells_profile_add(&profile, &state->profile);
+#endif
+
+		if (state->tick % statsEvery == 0)
+		{
+			double end = now();
+
+			TIMING_BEGIN(TIMING_STATS);
+			print_stats(stats, statsFormat, state, (state->tick - lastTick) / (end - start));
+			fflush(stats);
+			TIMING_END(TIMING_STATS);
+
+			start = end;
+			lastTick = state->tick;
+		}
+
+		// the tick loop never waits for the disk, a slow snapshot just skips the next one
+		saved = false;
+		if (snapshotEvery && state->tick % snapshotEvery == 0 && !(saved = checkpoint_start(checkpoint, state)))
+			fprintf(stderr, "Skipping snapshot at tick %llu, the previous one is still being written\n", state->tick);
+	}
+
+	if (checkpoint)
+	{
+		ok = checkpoint_wait(checkpoint) && ok;
+		if (!saved)
+			checkpoint_start(checkpoint, state);
+		ok = checkpoint_destroy(checkpoint) && ok;
+	}
+
+	// a full disk may only show up when the last buffered stats are written
+	bool written = !ferror(stats);
+	if (stats != stdout)
+		written = fclose(stats) == 0 && written;
+	if (!written)
+	{
+		fprintf(stderr, "Writing stats \"%s\" failed\n", statsPath ? statsPath : "stdout");
+		ok = false;
+	}
+
+	if (!lineage_log_close(lineage))
+	{
+		fprintf(stderr, "Writing lineage log \"%s\" failed\n", lineagePath);
+		ok = false;
+	}
+
+	// stats may go to stdout, timings stay apart from them
+	TIMING_REPORT(stderr);
+#ifdef CELLS_PROFILE
+	cells_profile_report(stderr, &profile);
+#endif
+
+	cells_quit(state);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
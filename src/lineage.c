@@ -0,0 +1,604 @@
+#include "lineage.h"
+#include "util.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// first size of the hash table, it doubles when half full
+#define LINEAGE_TABLE_SIZE 1024
+
+size_t lineage_pool_block_size(const uint32_t capacity)
+{
+	const size_t chunks = ((size_t)capacity + LINEAGE_CHUNK_SIZE) / LINEAGE_CHUNK_SIZE;
+
+	return chunks * LINEAGE_CHUNK_SIZE * sizeof(struct lineage_entry);
+}
+
+// makes a pool over a block of whole chunks
+static struct lineage_pool *lineage_pool_new(struct lineage_entry *block, const size_t blockSize, const size_t mappingSize)
+{
+	struct lineage_pool *pool = calloc(1, sizeof(struct lineage_pool));
+	assert(pool);
+
+	pool->chunks = calloc(LINEAGE_CHUNKS, sizeof(*pool->chunks));
+	assert(pool->chunks);
+
+	pool->block = block;
+	pool->blockChunks = blockSize / sizeof(struct lineage_entry) / LINEAGE_CHUNK_SIZE;
+	pool->mappingSize = mappingSize;
+	pool->capacity = pool->blockChunks * LINEAGE_CHUNK_SIZE - 1;
+
+	for (uint32_t i = 0; i < pool->blockChunks; i++)
+		pool->chunks[i] = block + (size_t)i * LINEAGE_CHUNK_SIZE;
+
+	pool->freeList = LINEAGE_NONE;
+	pool->nextId = 1;
+	block[LINEAGE_NONE].used = true;
+
+	pthread_mutex_init(&pool->lock, NULL);
+
+	return pool;
+}
+
+struct lineage_pool *lineage_pool_create(const uint32_t capacity)
+{
+	assert(capacity < UINT32_MAX);
+
+	const size_t blockSize = lineage_pool_block_size(capacity);
+
+	// calloc'ed memory is only backed once it's touched, so unused entries cost nothing
+	struct lineage_entry *block = calloc(1, blockSize);
+	assert(block);
+
+	struct lineage_pool *pool = lineage_pool_new(block, blockSize, 0);
+	pool->tableSize = LINEAGE_TABLE_SIZE;
+	pool->table = calloc(pool->tableSize, sizeof(*pool->table));
+	assert(pool->table);
+
+	pool->top = 1;
+
+	return pool;
+}
+
+// puts handle into the hash table, which has a free bucket
+static void lineage_pool_insert(struct lineage_pool *pool, const lineage_handle handle);
+
+struct lineage_pool *lineage_pool_map(struct lineage_entry *block, const size_t mappingSize, const uint32_t top,
+									  const uint64_t nextId)
+{
+	assert(mappingSize % (LINEAGE_CHUNK_SIZE * sizeof(struct lineage_entry)) == 0);
+	assert(top > 0 && top <= mappingSize / sizeof(struct lineage_entry));
+
+	uint32_t count = 0;
+
+	for (lineage_handle handle = 1; handle < top; handle++)
+	{
+		const struct lineage_entry *entry = &block[handle];
+
+		if (entry->used && (entry->pending || entry->id == 0 || entry->id >= nextId))
+			return NULL;
+
+		count += entry->used;
+	}
+
+	struct lineage_pool *pool = lineage_pool_new(block, mappingSize, mappingSize);
+	pool->top = top;
+	pool->count = count;
+	pool->nextId = nextId;
+
+	pool->tableSize = LINEAGE_TABLE_SIZE;
+	while (pool->count * 2 > pool->tableSize)
+		pool->tableSize *= 2;
+
+	pool->table = calloc(pool->tableSize, sizeof(*pool->table));
+	assert(pool->table);
+
+	// going down, so the free list hands out low handles first
+	for (lineage_handle handle = top - 1; handle > LINEAGE_NONE; handle--)
+	{
+		if (block[handle].used)
+			lineage_pool_insert(pool, handle);
+		else
+		{
+			block[handle].nextFree = pool->freeList;
+			pool->freeList = handle;
+		}
+	}
+
+	return pool;
+}
+
+void lineage_pool_destroy(struct lineage_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_destroy(&pool->lock);
+
+	for (size_t i = pool->blockChunks; i < LINEAGE_CHUNKS && pool->chunks[i]; i++)
+		free(pool->chunks[i]);
+
+	if (pool->mappingSize)
+		munmap(pool->block, pool->mappingSize);
+	else
+		free(pool->block);
+	free(pool->chunks);
+	free(pool->table);
+	free(pool);
+}
+
+static size_t lineage_pool_home(const struct lineage_pool *pool, const uint64_t id)
+{
+	return util_hash64(id) & (pool->tableSize - 1);
+}
+
+// puts handle into the hash table, which has a free bucket
+static void lineage_pool_insert(struct lineage_pool *pool, const lineage_handle handle)
+{
+	const size_t mask = pool->tableSize - 1;
+	size_t bucket = lineage_pool_home(pool, lineage_pool_entry(pool, handle)->id);
+
+	while (pool->table[bucket] != LINEAGE_NONE)
+		bucket = (bucket + 1) & mask;
+
+	pool->table[bucket] = handle;
+}
+
+static void lineage_pool_grow(struct lineage_pool *pool)
+{
+	lineage_handle *old = pool->table;
+	const size_t oldSize = pool->tableSize;
+
+	pool->tableSize *= 2;
+	pool->table = calloc(pool->tableSize, sizeof(*pool->table));
+	assert(pool->table);
+
+	for (size_t i = 0; i < oldSize; i++)
+	{
+		if (old[i] != LINEAGE_NONE)
+			lineage_pool_insert(pool, old[i]);
+	}
+
+	free(old);
+}
+
+// gives the entry an id and makes it findable by it
+static void lineage_pool_name(struct lineage_pool *pool, const lineage_handle handle, const uint64_t id)
+{
+	lineage_pool_entry(pool, handle)->id = id;
+
+	if (pool->count * 2 > pool->tableSize)
+		lineage_pool_grow(pool);
+
+	lineage_pool_insert(pool, handle);
+}
+
+// takes handle out of the hash table, shifting back entries which probed past it
+static void lineage_pool_remove(struct lineage_pool *pool, const lineage_handle handle)
+{
+	const size_t mask = pool->tableSize - 1;
+	size_t hole = lineage_pool_home(pool, lineage_pool_entry(pool, handle)->id);
+
+	while (pool->table[hole] != handle)
+		hole = (hole + 1) & mask;
+
+	for (size_t bucket = (hole + 1) & mask; pool->table[bucket] != LINEAGE_NONE; bucket = (bucket + 1) & mask)
+	{
+		const size_t home = lineage_pool_home(pool, lineage_pool_entry(pool, pool->table[bucket])->id);
+
+		// entry can fill the hole, if its home bucket isn't between the hole and its bucket
+		if (((bucket - home) & mask) >= ((bucket - hole) & mask))
+		{
+			pool->table[hole] = pool->table[bucket];
+			hole = bucket;
+		}
+	}
+
+	pool->table[hole] = LINEAGE_NONE;
+}
+
+// takes an entry off the free list, or the next never used one
+static lineage_handle lineage_pool_allocate(struct lineage_pool *pool)
+{
+	pool->count++;
+
+	if (pool->freeList != LINEAGE_NONE)
+	{
+		const lineage_handle handle = pool->freeList;
+		pool->freeList = lineage_pool_entry(pool, handle)->nextFree;
+		return handle;
+	}
+
+	if (pool->top > pool->capacity)
+	{
+		// another chunk, the entries in use stay where they are
+		assert(pool->top < UINT32_MAX);
+
+		struct lineage_entry **chunk = &pool->chunks[pool->top >> LINEAGE_CHUNK_SHIFT];
+		*chunk = calloc(LINEAGE_CHUNK_SIZE, sizeof(struct lineage_entry));
+		assert(*chunk);
+
+		pool->capacity += LINEAGE_CHUNK_SIZE;
+	}
+
+	return pool->top++;
+}
+
+// returns entry to the free list, the lock has to be held
+static void lineage_pool_free(struct lineage_pool *pool, const lineage_handle handle)
+{
+	struct lineage_entry *entry = lineage_pool_entry(pool, handle);
+
+	if (entry->id)
+		lineage_pool_remove(pool, handle);
+
+	entry->used = false;
+	entry->nextFree = pool->freeList;
+	pool->freeList = handle;
+	pool->count--;
+}
+
+lineage_handle lineage_pool_mint(struct lineage_pool *pool, const lineage_handle parent, const uint64_t id)
+{
+	pthread_mutex_lock(&pool->lock);
+
+	const lineage_handle handle = lineage_pool_allocate(pool);
+	struct lineage_entry *entry = lineage_pool_entry(pool, handle);
+
+	*entry = (struct lineage_entry){.parent = parent, .alive = 1, .refs = 1, .used = true, .pending = true};
+
+	if (id)
+		lineage_pool_name(pool, handle, id);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	lineage_pool_retain(pool, parent);
+
+	return handle;
+}
+
+lineage_handle lineage_pool_intern(struct lineage_pool *pool, const uint64_t id)
+{
+	assert(id != 0);
+
+	pthread_mutex_lock(&pool->lock);
+
+	const size_t mask = pool->tableSize - 1;
+
+	for (size_t bucket = lineage_pool_home(pool, id); pool->table[bucket] != LINEAGE_NONE; bucket = (bucket + 1) & mask)
+	{
+		const lineage_handle handle = pool->table[bucket];
+		struct lineage_entry *entry = lineage_pool_entry(pool, handle);
+
+		if (entry->id == id)
+		{
+			// may bring back an entry, whose last holder is about to free it
+			__atomic_fetch_add(&entry->refs, 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&pool->lock);
+			return handle;
+		}
+	}
+
+	const lineage_handle handle = lineage_pool_allocate(pool);
+
+	*lineage_pool_entry(pool, handle) = (struct lineage_entry){.refs = 1, .used = true};
+	lineage_pool_name(pool, handle, id);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return handle;
+}
+
+void lineage_pool_release(struct lineage_pool *pool, const lineage_handle handle)
+{
+	if (handle == LINEAGE_NONE)
+		return;
+
+	struct lineage_entry *entry = lineage_pool_entry(pool, handle);
+
+	if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+
+	// someone could have interned it again, or freed it already, pending ones wait for lineage_pool_settle()
+	if (entry->used && !entry->pending && __atomic_load_n(&entry->refs, __ATOMIC_RELAXED) == 0)
+		lineage_pool_free(pool, handle);
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+uint64_t lineage_pool_settle(struct lineage_pool *pool, const lineage_handle handle, uint64_t *parent)
+{
+	struct lineage_entry *entry = lineage_pool_entry(pool, handle);
+
+	assert(entry->used && entry->pending);
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (!entry->id)
+		lineage_pool_name(pool, handle, pool->nextId++);
+
+	const uint64_t id = entry->id;
+	const lineage_handle parentHandle = entry->parent;
+
+	*parent = parentHandle != LINEAGE_NONE ? lineage_pool_entry(pool, parentHandle)->id : 0;
+	entry->parent = LINEAGE_NONE;
+	entry->pending = false;
+
+	if (__atomic_load_n(&entry->refs, __ATOMIC_RELAXED) == 0)
+		lineage_pool_free(pool, handle);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	lineage_pool_release(pool, parentHandle);
+
+	return id;
+}
+
+size_t lineage_pool_memory_usage(const struct lineage_pool *pool)
+{
+	return sizeof(struct lineage_pool) + pool->top * sizeof(struct lineage_entry) + pool->tableSize * sizeof(*pool->table) +
+		   ((size_t)pool->capacity + 1) / LINEAGE_CHUNK_SIZE * sizeof(*pool->chunks);
+}
+
+#define LINEAGE_LOG_MAGIC "CELLSLIN"
+// magic and version, without the checksum
+#define LINEAGE_HEADER_SIZE (8 + 4)
+// reader refuses bigger blocks as corrupted
+#define LINEAGE_MAX_BLOCK_SIZE (256 * 1024 * 1024)
+
+struct lineage_log
+{
+	FILE *f;
+	bool ok;
+	// payload of the block being written
+	uint8_t *block;
+	size_t size;
+	size_t capacity;
+};
+
+// 7 bits per byte, high bit is set on all bytes but the last
+static void lineage_log_varint(struct lineage_log *log, uint64_t value)
+{
+	// longest varint is 10 bytes
+	if (log->size + 10 > log->capacity)
+	{
+		log->capacity = (log->size + 10) * 2;
+		log->block = realloc(log->block, log->capacity);
+		assert(log->block);
+	}
+
+	for (; value >= 0x80; value >>= 7)
+		log->block[log->size++] = value | 0x80;
+
+	log->block[log->size++] = value;
+}
+
+static void lineage_log_u32(uint8_t bytes[4], const uint32_t value)
+{
+	bytes[0] = value;
+	bytes[1] = value >> 8;
+	bytes[2] = value >> 16;
+	bytes[3] = value >> 24;
+}
+
+struct lineage_log *lineage_log_open(const char *path)
+{
+	FILE *f = fopen(path, "ab");
+	if (!f)
+		return NULL;
+
+	struct lineage_log *log = calloc(1, sizeof(struct lineage_log));
+	assert(log);
+
+	log->f = f;
+	log->ok = fseek(f, 0, SEEK_END) == 0;
+
+	const long size = ftell(f);
+	if (log->ok && size == 0)
+	{
+		uint8_t header[LINEAGE_HEADER_SIZE + 4];
+
+		memcpy(header, LINEAGE_LOG_MAGIC, 8);
+		lineage_log_u32(header + 8, LINEAGE_LOG_VERSION);
+		lineage_log_u32(header + LINEAGE_HEADER_SIZE, util_crc32(0, header, LINEAGE_HEADER_SIZE));
+
+		log->ok = fwrite(header, sizeof(header), 1, f) == 1;
+	}
+	else
+		log->ok = log->ok && size > 0;
+
+	return log;
+}
+
+// newest ids first
+static int lineage_log_compare(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x < y) - (x > y);
+}
+
+bool lineage_log_write(struct lineage_log *log, const uint64_t tick, const uint64_t firstId, const uint64_t *parents,
+					   const uint32_t births, uint64_t *extinctions, const uint32_t extinctionCount)
+{
+	if (!births && !extinctionCount)
+		return log->ok;
+
+	log->size = 0;
+	lineage_log_varint(log, tick);
+	lineage_log_varint(log, firstId);
+	lineage_log_varint(log, births);
+
+	for (uint32_t i = 0; i < births; i++)
+		lineage_log_varint(log, parents[i] ? firstId + i - parents[i] : 0);
+
+	qsort(extinctions, extinctionCount, sizeof(uint64_t), lineage_log_compare);
+
+	lineage_log_varint(log, extinctionCount);
+
+	uint64_t previous = firstId + births;
+	for (uint32_t i = 0; i < extinctionCount; i++)
+	{
+		lineage_log_varint(log, previous - extinctions[i]);
+		previous = extinctions[i];
+	}
+
+	const size_t payload = log->size;
+	uint8_t crc[4];
+	lineage_log_u32(crc, util_crc32(0, log->block, payload));
+
+	// size goes in front of the payload, written from a separate buffer
+	uint8_t head[10];
+	size_t headSize = 0;
+	uint64_t value = payload;
+	for (; value >= 0x80; value >>= 7)
+		head[headSize++] = value | 0x80;
+	head[headSize++] = value;
+
+	log->ok = log->ok && fwrite(head, headSize, 1, log->f) == 1 && fwrite(log->block, payload, 1, log->f) == 1 &&
+			  fwrite(crc, 4, 1, log->f) == 1;
+
+	return log->ok;
+}
+
+bool lineage_log_close(struct lineage_log *log)
+{
+	if (!log)
+		return true;
+
+	bool ok = log->ok && fflush(log->f) == 0;
+	ok = fclose(log->f) == 0 && ok;
+
+	free(log->block);
+	free(log);
+
+	return ok;
+}
+
+// reads a varint from the file, false if it ends first
+static bool lineage_read_file_varint(FILE *f, uint64_t *value)
+{
+	*value = 0;
+
+	for (unsigned shift = 0; shift < 64; shift += 7)
+	{
+		const int byte = getc(f);
+		if (byte == EOF)
+			return false;
+
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+// reads a varint from the payload, false on overrun
+static bool lineage_read_varint(const uint8_t *data, const size_t size, size_t *offset, uint64_t *value)
+{
+	*value = 0;
+
+	for (unsigned shift = 0; shift < 64 && *offset < size; shift += 7)
+	{
+		const uint8_t byte = data[(*offset)++];
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+static uint32_t lineage_read_u32(const uint8_t bytes[4])
+{
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+// prints one block, false if the payload doesn't add up
+static bool lineage_log_dump_block(const uint8_t *data, const size_t size, FILE *out)
+{
+	size_t offset = 0;
+	uint64_t tick, firstId, births, extinctions;
+
+	if (!lineage_read_varint(data, size, &offset, &tick) || !lineage_read_varint(data, size, &offset, &firstId) ||
+		!lineage_read_varint(data, size, &offset, &births) || births > size)
+		return false;
+
+	for (uint64_t i = 0; i < births; i++)
+	{
+		uint64_t distance;
+		if (!lineage_read_varint(data, size, &offset, &distance) || distance > firstId + i)
+			return false;
+
+		const uint64_t id = firstId + i;
+
+		if (distance)
+			fprintf(out, "%" PRIu64 ",birth,%" PRIu64 ",%" PRIu64 "\n", tick, id, id - distance);
+		else
+			fprintf(out, "%" PRIu64 ",birth,%" PRIu64 ",\n", tick, id);
+	}
+
+	if (!lineage_read_varint(data, size, &offset, &extinctions) || extinctions > size)
+		return false;
+
+	uint64_t id = firstId + births;
+	for (uint64_t i = 0; i < extinctions; i++)
+	{
+		uint64_t distance;
+		if (!lineage_read_varint(data, size, &offset, &distance) || distance > id)
+			return false;
+
+		id -= distance;
+		fprintf(out, "%" PRIu64 ",extinction,%" PRIu64 ",\n", tick, id);
+	}
+
+	return offset == size;
+}
+
+bool lineage_log_dump(FILE *f, FILE *out)
+{
+	uint8_t header[LINEAGE_HEADER_SIZE + 4];
+
+	if (fread(header, sizeof(header), 1, f) != 1 || memcmp(header, LINEAGE_LOG_MAGIC, 8) != 0 ||
+		lineage_read_u32(header + 8) != LINEAGE_LOG_VERSION ||
+		lineage_read_u32(header + LINEAGE_HEADER_SIZE) != util_crc32(0, header, LINEAGE_HEADER_SIZE))
+		return false;
+
+	fprintf(out, "tick,event,id,parent\n");
+
+	uint8_t *block = NULL;
+	bool ok = true;
+	int next;
+
+	// stops at the end of the file, a block cut short anywhere counts as damage
+	while (ok && (next = getc(f)) != EOF)
+	{
+		ungetc(next, f);
+
+		uint64_t size;
+		uint8_t crc[4];
+
+		ok = lineage_read_file_varint(f, &size) && size <= LINEAGE_MAX_BLOCK_SIZE;
+		if (!ok)
+			break;
+
+		block = realloc(block, size + 1);
+		assert(block);
+
+		ok = fread(block, 1, size, f) == size && fread(crc, 4, 1, f) == 1 && lineage_read_u32(crc) == util_crc32(0, block, size) &&
+			 lineage_log_dump_block(block, size, out);
+	}
+
+	ok = ok && !ferror(f);
+
+	free(block);
+
+	return ok;
+}
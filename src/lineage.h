@@ -0,0 +1,180 @@
+#ifndef LINEAGE_H
+#define LINEAGE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// index of a lineage in struct lineage_pool, only ids leave the process
+typedef uint32_t lineage_handle;
+
+// empty slots belong to no lineage
+#define LINEAGE_NONE 0
+
+// entries come in chunks of that many, a full pool gets another chunk, so entries in use never move
+#define LINEAGE_CHUNK_SHIFT 16
+#define LINEAGE_CHUNK_SIZE (1u << LINEAGE_CHUNK_SHIFT)
+#define LINEAGE_CHUNKS (((size_t)UINT32_MAX >> LINEAGE_CHUNK_SHIFT) + 1)
+
+struct lineage_entry
+{
+	// serial number, 0 for a lineage minted by the tick, until the tick is logged
+	uint64_t id;
+	// lineage it split from, holds a reference to it until the birth is logged
+	lineage_handle parent;
+	// alive cells of the lineage, it's extinct when it drops to zero
+	uint32_t alive;
+	// cells holding the handle, alive or dead, and clones of the state
+	uint32_t refs;
+	// next entry in the free list, while the entry is unused
+	lineage_handle nextFree;
+	bool used;
+	// birth wasn't logged yet, the entry isn't freed until it is
+	bool pending;
+};
+
+/*
+	Lineages of cells. A child gets the lineage of its parent, unless its
+	genome mutated, then a new lineage is minted with a link to the
+	parent's. Random cells start lineages without a parent.
+	Like struct genome_pool, entries never move and are read without
+	locking, reference and alive counts change atomically, minting and
+	freeing take the lock. A clone of the cells keeps its lineages while
+	the original mints new ones, so the pool grows when it's full. Ids
+	are serial numbers, lineages minted during a tick get them when the
+	tick is done, in the order of tiles, so they don't depend on the
+	number of threads.
+*/
+struct lineage_pool
+{
+	// LINEAGE_CHUNKS pointers, entry of a handle is chunks[handle >> LINEAGE_CHUNK_SHIFT][handle % LINEAGE_CHUNK_SIZE]
+	struct lineage_entry **chunks;
+	// first blockChunks chunks are one block, later ones are calloc'ed on their own
+	struct lineage_entry *block;
+	uint32_t blockChunks;
+	// size of the mmap()'ed block, 0 if it's calloc'ed
+	size_t mappingSize;
+	// handles up to capacity have an entry, entry LINEAGE_NONE is unused
+	uint32_t capacity;
+	// entries below top were used at least once, the rest was never touched
+	uint32_t top;
+	lineage_handle freeList;
+	// number of used entries
+	uint32_t count;
+	// id the next lineage gets
+	uint64_t nextId;
+
+	// id -> handle, linear probing, LINEAGE_NONE marks a free bucket, only lineages with an id are in it
+	lineage_handle *table;
+	size_t tableSize;
+
+	pthread_mutex_t lock;
+};
+
+// creates pool with room for capacity lineages, it grows past that
+struct lineage_pool *lineage_pool_create(const uint32_t capacity);
+
+// returns size of a block of whole chunks, which holds capacity + 1 entries
+size_t lineage_pool_block_size(const uint32_t capacity);
+
+/*
+	Creates pool over a block of entries mapped by the caller, which is
+	lineage_pool_block_size() bytes, like genome_pool_map(). Returns NULL
+	and leaves the mapping to the caller, if a used entry below top is
+	pending or hasn't got an id below nextId. Otherwise the mapping is
+	released with munmap() in lineage_pool_destroy().
+*/
+struct lineage_pool *lineage_pool_map(struct lineage_entry *block, const size_t mappingSize, const uint32_t top,
+									  const uint64_t nextId);
+
+void lineage_pool_destroy(struct lineage_pool *pool);
+
+/*
+	Returns new pending lineage with one alive cell, which holds its only
+	reference. Id 0 leaves the id to lineage_pool_settle().
+*/
+lineage_handle lineage_pool_mint(struct lineage_pool *pool, const lineage_handle parent, const uint64_t id);
+
+// returns handle of lineage with given id with one reference taken, adds it without cells if it isn't there
+lineage_handle lineage_pool_intern(struct lineage_pool *pool, const uint64_t id);
+
+// drops one reference, frees the lineage when it was the last one and its birth was logged
+void lineage_pool_release(struct lineage_pool *pool, const lineage_handle handle);
+
+/*
+	Logs birth of a pending lineage: gives it the next id, unless it has
+	one, returns it and the parent's id ( 0 without parent ) and drops the
+	reference to the parent. Lineages are settled in the order they were
+	minted, so a parent always has its id first.
+*/
+uint64_t lineage_pool_settle(struct lineage_pool *pool, const lineage_handle handle, uint64_t *parent);
+
+// returns number of bytes the pool has touched so far
+size_t lineage_pool_memory_usage(const struct lineage_pool *pool);
+
+static inline struct lineage_entry *lineage_pool_entry(const struct lineage_pool *pool, const lineage_handle handle)
+{
+	return &pool->chunks[handle >> LINEAGE_CHUNK_SHIFT][handle & (LINEAGE_CHUNK_SIZE - 1)];
+}
+
+// takes one more reference to a lineage
+static inline void lineage_pool_retain(struct lineage_pool *pool, const lineage_handle handle)
+{
+	if (handle != LINEAGE_NONE)
+		__atomic_fetch_add(&lineage_pool_entry(pool, handle)->refs, 1, __ATOMIC_RELAXED);
+}
+
+// counts a newborn alive cell of the lineage
+static inline void lineage_pool_born(struct lineage_pool *pool, const lineage_handle handle)
+{
+	if (handle != LINEAGE_NONE)
+		__atomic_fetch_add(&lineage_pool_entry(pool, handle)->alive, 1, __ATOMIC_RELAXED);
+}
+
+// counts death of an alive cell, returns true if it was the last one of the lineage
+static inline bool lineage_pool_died(struct lineage_pool *pool, const lineage_handle handle)
+{
+	return handle != LINEAGE_NONE && __atomic_sub_fetch(&lineage_pool_entry(pool, handle)->alive, 1, __ATOMIC_RELAXED) == 0;
+}
+
+static inline const struct lineage_entry *lineage_pool_get(const struct lineage_pool *pool, const lineage_handle handle)
+{
+	return lineage_pool_entry(pool, handle);
+}
+
+/*
+	Lineage log file, all numbers are little endian.
+	Header: "CELLSLIN", version and CRC-32 of both. Then a block for every
+	tick, which had any events: payload size as varint, payload and its
+	CRC-32. Payload is a sequence of varints: tick, id of the first birth,
+	number of births, for every birth the distance of its id to the
+	parent's ( 0 without parent ), ids of births go up by one from the
+	first. Then number of extinctions and their ids in descending order,
+	each as the distance to the previous one, starting from the id after
+	the last birth. A resumed run appends to the file, so ticks after the
+	snapshot show up twice, the later blocks replace the earlier ones.
+*/
+#define LINEAGE_LOG_VERSION 1
+
+struct lineage_log;
+
+// opens log for appending, writes the header to an empty file, returns NULL on failure
+struct lineage_log *lineage_log_open(const char *path);
+
+/*
+	Writes events of one tick, extinctions get sorted. Births have ids
+	from firstId on, parents holds their parent ids. Returns false after
+	any write error.
+*/
+bool lineage_log_write(struct lineage_log *log, const uint64_t tick, const uint64_t firstId, const uint64_t *parents,
+					   const uint32_t births, uint64_t *extinctions, const uint32_t extinctionCount);
+
+// flushes and closes the log, returns false if anything failed
+bool lineage_log_close(struct lineage_log *log);
+
+// prints events of a log as CSV lines: tick, birth or extinction, id, parent, returns false if it's corrupted
+bool lineage_log_dump(FILE *f, FILE *out);
+
+#endif
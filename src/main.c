@@ -2,24 +2,28 @@
 #include <SDL2/SDL_image.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <time.h>
-#include <sys/time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "cells.h"
+#include "checkpoint.h"
 #include "defines.h"
+#include "frames.h"
+#include "render.h"
+#include "timing.h"
 #include "util.h"
 
-enum RENDERING_MODE
-{
-	RENDER_ENERGY,
-	RENDER_RELATIVES,
-	RENDER_AGE,
-	RENDER_ENERGY_SOURCE
-};
+// how long the simulation thread and the event loop sleep, while there's nothing to do
+#define SIM_IDLE_DELAY_MS 5
 
 SDL_Window *win;
 SDL_Renderer *ren;
+// one pixel per cell, stretched to CELL_WIDTH x CELL_HEIGHT when copied to the window
+SDL_Texture *worldTexture;
 
 SDL_Texture *loadImage(const char *path)
 {
@@ -42,7 +46,7 @@ SDL_Texture *loadImage(const char *path)
 	return texture;
 }
 
-void init()
+void init(const unsigned width, const unsigned height)
 {
 	// init SDL
 	assert(SDL_Init(SDL_INIT_EVERYTHING) == 0);
@@ -54,7 +58,7 @@ void init()
 	win = SDL_CreateWindow(
 		"Cell simulation",												// title
 		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,				// x and y position
-		SIMULATION_WIDTH * CELL_WIDTH, SIMULATION_HEIGHT * CELL_HEIGHT, // width and height
+		width * CELL_WIDTH, height * CELL_HEIGHT,						// width and height
 		0																// flags
 	);
 	assert(win);
@@ -63,15 +67,23 @@ void init()
 	ren = SDL_CreateRenderer(
 		win,
 		-1,
-		SDL_RENDERER_ACCELERATED);
+		SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	assert(ren);
+
+	// cells stay sharp squares when scaled up
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+
+	worldTexture = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+	assert(worldTexture);
 }
 
 bool quit()
 {
+	SDL_DestroyTexture(worldTexture);
 	SDL_DestroyRenderer(ren);
 	SDL_DestroyWindow(win);
 
+	worldTexture = NULL;
 	ren = NULL;
 	win = NULL;
 
@@ -79,86 +91,329 @@ bool quit()
 	IMG_Quit();
 }
 
-void render(struct cells_state *state, enum RENDERING_MODE renderingMode)
+void render(const struct frame *frame)
 {
-	// clear the screen with black color
-	SDL_SetRenderDrawColor(ren, 0, 0, 0, 255);
+	// the frame is coloured by the simulation thread, it's uploaded at once instead of a draw call per cell
+	SDL_UpdateTexture(worldTexture, NULL, frame->pixels, frame->pitch);
+
 	SDL_RenderClear(ren);
+	SDL_RenderCopy(ren, worldTexture, NULL, NULL);
+	SDL_RenderPresent(ren);
+}
+
+/*
+	Simulation running on its own thread, so slow frames don't slow it
+	down and vice versa. The thread holds lock for each tick, the event
+	loop takes it to change the state or the fields below. Frames go to
+	the event loop through the triple buffer, without locking.
+*/
+struct sim
+{
+	pthread_mutex_t lock;
+	// number of threads waiting for lock, the simulation thread lets them in between ticks
+	unsigned waiting;
+
+	struct cells_state *state;
+	struct checkpoint *checkpoint;
+	struct frames *frames;
+
+	enum RENDERING_MODE renderingMode;
+	bool paused;
+	// run one tick, even when paused
+	bool step;
+	// state or rendering mode changed since the last frame
+	bool redraw;
+	// grows when the state is replaced or the rendering mode changes, frames of older epochs are drawn whole
+	unsigned epoch;
+	bool quit;
+
+	// ticks per second, 0 runs as fast as possible
+	unsigned tickRate;
+	unsigned long long snapshotEvery;
+	long long unsigned iterations;
+};
+
+static double sim_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-	// render the map
-	for (int i = 0; i < SIMULATION_WIDTH; i++)
+static void sim_sleep_until(const double deadline)
+{
+	const struct timespec ts = {(time_t)deadline, (long)((deadline - (time_t)deadline) * 1e9)};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+		;
+}
+
+static void sim_lock(struct sim *sim)
+{
+	__atomic_add_fetch(&sim->waiting, 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&sim->lock);
+	__atomic_sub_fetch(&sim->waiting, 1, __ATOMIC_RELEASE);
+}
+
+static void sim_unlock(struct sim *sim)
+{
+	pthread_mutex_unlock(&sim->lock);
+}
+
+static void *sim_thread(void *arg)
+{
+	struct sim *sim = arg;
+	double deadline = sim_now();
+	double lastStatus = deadline;
+
+	while (true)
 	{
-		for (int j = 0; j < SIMULATION_HEIGHT; j++)
+		pthread_mutex_lock(&sim->lock);
+
+		if (sim->quit)
 		{
+			pthread_mutex_unlock(&sim->lock);
+			break;
+		}
 
-			struct cell *cell = cells_get_cell(state, i, j);
+		struct cells_state *state = sim->state;
+		const bool tick = !sim->paused || sim->step;
+		const unsigned tickRate = sim->tickRate;
+		sim->step = false;
 
-			if (cell->empty)
-				continue;
+		if (tick)
+		{
+			TIMING_BEGIN(TIMING_TICK);
+			cells_update_state(state);
+			TIMING_END(TIMING_TICK);
 
-			unsigned r = 0, g = 0, b = 0;
+			sim->iterations++;
+			sim->redraw = true;
 
-			if (cell->alive)
-			{
+			TIMING_BEGIN(TIMING_STATS);
 
-				if (renderingMode == RENDER_RELATIVES)
-					r = cell->r, g = cell->g, b = cell->b;
-				else if (renderingMode == RENDER_ENERGY)
-				{
-					float energy = cell->energy / (REPRODUCTION_REQUIRED_ENERGY * 2) * 255.f;
-					r = energy, g = energy;
-				}
-				else if (renderingMode == RENDER_AGE)
-					b = 50 + 255.f * ((float)cell->age / (float)CELL_MAX_AGE);
-				else if (renderingMode == RENDER_ENERGY_SOURCE)
-				{
-					float max_value = util_max(3, (float[]){cell->photosynthesisCount, cell->attackCount, cell->eatingDeadCount});
+			if (sim->snapshotEvery && state->tick % sim->snapshotEvery == 0 && !checkpoint_start(sim->checkpoint, state))
+				fprintf(stderr, "Skipping snapshot at tick %llu, the previous one is still being written\n", state->tick);
 
-					r = cell->attackCount / max_value * 255.f;
-					g = cell->photosynthesisCount / max_value * 255.f;
-					b = cell->eatingDeadCount / max_value * 255.f;
-				}
+			// rate over the last 10 ticks, pauses and waits included
+			if (sim->iterations % 10 == 0)
+			{
+				const double now = sim_now();
+
+				printf("[ iteration %llu ] [ ticks/s %.1f ] Alive cells: %u\n", sim->iterations, 10 / (now - lastStatus),
+					   cells_count_alive_cells(state));
+				lastStatus = now;
 			}
-			else
+
+			if (sim->iterations % 100 == 0)
 			{
-				r = 70, g = 70, b = 70;
+				TIMING_REPORT(stdout);
+#ifdef CELLS_PROFILE
+				cells_profile_report(stdout, &state->profile);
+#endif
 			}
 
-			r = util_clamp(r, 0, 255);
-			g = util_clamp(g, 0, 255);
-			b = util_clamp(b, 0, 255);
+			TIMING_END(TIMING_STATS);
+		}
 
-			SDL_SetRenderDrawColor(ren, r, g, b, 255);
-			SDL_Rect fillRect = {i * CELL_WIDTH, j * CELL_HEIGHT, CELL_WIDTH, CELL_HEIGHT};
-			SDL_RenderFillRect(ren, &fillRect);
+		// a new frame is only coloured once the previous one was taken, ticks nobody sees aren't drawn
+		if (sim->redraw && !frames_pending(sim->frames))
+		{
+			TIMING_BEGIN(TIMING_COLOR);
+			struct frame *frame = frames_back(sim->frames);
+
+			// the back frame was drawn a couple of frames ago, only what changed since then is drawn again
+			if (frame->epoch == sim->epoch)
+				render_pixels_since(state, sim->renderingMode, frame->pixels, frame->pitch, frame->version);
+			else
+				render_pixels(state, sim->renderingMode, frame->pixels, frame->pitch);
+
+			frame->tick = state->tick;
+			frame->version = state->version;
+			frame->epoch = sim->epoch;
+
+			frames_publish(sim->frames);
+			sim->redraw = false;
+			TIMING_END(TIMING_COLOR);
+		}
+
+		pthread_mutex_unlock(&sim->lock);
+
+		// mutexes aren't fair, without this the event loop could wait for many ticks
+		while (__atomic_load_n(&sim->waiting, __ATOMIC_ACQUIRE))
+			sched_yield();
+
+		if (!tick)
+		{
+			deadline = sim_now() + SIM_IDLE_DELAY_MS / 1000.;
+			sim_sleep_until(deadline);
+		}
+		else if (tickRate)
+		{
+			// a late tick moves the schedule instead of running a burst of ticks to catch up
+			deadline += 1. / tickRate;
+			const double now = sim_now();
+
+			if (deadline > now)
+				sim_sleep_until(deadline);
+			else
+				deadline = now;
 		}
 	}
 
-	SDL_RenderPresent(ren);
+	return NULL;
+}
+
+void usage(const char *program)
+{
+	printf("Usage: %s [options]\n", program);
+	printf("  -w, --width N    simulation width in cells ( default %d )\n", SIMULATION_WIDTH);
+	printf("  -h, --height N   simulation height in cells ( default %d )\n", SIMULATION_HEIGHT);
+	printf("  -t, --threads N  number of simulation threads ( default 1 )\n");
+	printf("  -s, --seed N     random seed ( default is current time )\n");
+	printf("      --tick-mode MODE  in-place ( default ) or once, see enum cells_tick_mode\n");
+	printf("      --relative-threshold N  equal genes needed to treat cells as relatives ( default genome length - 1 )\n");
+	printf("      --config FILE       set simulation parameters from FILE of name=value pairs, # starts a comment\n");
+	printf("  -p, --param NAME=VALUE  set simulation parameter, see cells_set_param() for names, applied in order\n");
+	printf("      --snapshot-every N  save the simulation to save.bin every N ticks in the background\n");
+	printf("      --snapshot-keep N   number of snapshots kept as save.bin, save.bin.1, ... ( default 1 )\n");
+	printf("      --tick-rate N       ticks per second, 0 runs as fast as possible ( default 0 )\n");
+	printf("      --help       show this message\n");
 }
 
 int main(int argc, char *argv[])
 {
-	srand(time(0));
-	init();
+	unsigned width = SIMULATION_WIDTH;
+	unsigned height = SIMULATION_HEIGHT;
+	unsigned threads = 1;
+	uint64_t seed = time(NULL);
+	enum cells_tick_mode tickMode = TICK_IN_PLACE;
+	// -1 keeps the default of cells_init()
+	int relativeThreshold = -1;
+	struct cells_params params = cells_default_params();
+	unsigned long long snapshotEvery = 0;
+	unsigned snapshotKeep = 1;
+	unsigned tickRate = 0;
+
+	enum
+	{
+		OPTION_HELP = 256,
+		OPTION_TICK_MODE,
+		OPTION_RELATIVE_THRESHOLD,
+		OPTION_SNAPSHOT_EVERY,
+		OPTION_SNAPSHOT_KEEP,
+		OPTION_TICK_RATE,
+		OPTION_CONFIG,
+	};
+
+	const struct option options[] = {
+		{"width", required_argument, NULL, 'w'},
+		{"height", required_argument, NULL, 'h'},
+		{"threads", required_argument, NULL, 't'},
+		{"seed", required_argument, NULL, 's'},
+		{"tick-mode", required_argument, NULL, OPTION_TICK_MODE},
+		{"relative-threshold", required_argument, NULL, OPTION_RELATIVE_THRESHOLD},
+		{"config", required_argument, NULL, OPTION_CONFIG},
+		{"param", required_argument, NULL, 'p'},
+		{"snapshot-every", required_argument, NULL, OPTION_SNAPSHOT_EVERY},
+		{"snapshot-keep", required_argument, NULL, OPTION_SNAPSHOT_KEEP},
+		{"tick-rate", required_argument, NULL, OPTION_TICK_RATE},
+		{"help", no_argument, NULL, OPTION_HELP},
+		{0},
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "w:h:t:s:p:", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'w':
+			width = util_parse_number("--width", optarg, 1, 65535);
+			break;
+		case 'h':
+			height = util_parse_number("--height", optarg, 1, 65535);
+			break;
+		case 't':
+			threads = util_parse_number("--threads", optarg, 1, 1024);
+			break;
+		case 's':
+			seed = util_parse_number("--seed", optarg, 0, UINT64_MAX);
+			break;
+		case OPTION_TICK_MODE:
+			if (!cells_parse_tick_mode(optarg, &tickMode))
+			{
+				fprintf(stderr, "unknown tick mode '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPTION_RELATIVE_THRESHOLD:
+			relativeThreshold = util_parse_number("--relative-threshold", optarg, 0, GENOME_MAX_LENGTH);
+			break;
+		case OPTION_CONFIG:
+			if (!cells_load_params(&params, optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'p':
+			if (!cells_parse_param(&params, optarg))
+			{
+				fprintf(stderr, "expected NAME=VALUE of a known parameter for --param, got '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPTION_SNAPSHOT_EVERY:
+			snapshotEvery = util_parse_number("--snapshot-every", optarg, 1, UINT64_MAX);
+			break;
+		case OPTION_SNAPSHOT_KEEP:
+			snapshotKeep = util_parse_number("--snapshot-keep", optarg, 1, 1000);
+			break;
+		case OPTION_TICK_RATE:
+			tickRate = util_parse_number("--tick-rate", optarg, 0, 1000000);
+			break;
+		case OPTION_HELP:
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	init(width, height);
 
 	// initialize the simulation
-	struct cells_state *state = cells_init();
+	printf("Seed %llu\n", (unsigned long long)seed);
+	struct cells_state *state = cells_init(width, height, seed, &params, START_DENSITY);
 	assert(state);
+	cells_set_threads(state, threads);
+	state->tickMode = tickMode;
+	if (relativeThreshold >= 0)
+		state->relativeThreshold = relativeThreshold;
+
+	struct sim sim = {
+		.state = state,
+		// S and --snapshot-every write save.bin without stopping the simulation
+		.checkpoint = checkpoint_create("save.bin", snapshotKeep, SNAPSHOT_STREAM),
+		.frames = frames_create(width, height),
+		.renderingMode = RENDER_RELATIVES,
+		.paused = true,
+		.redraw = true,
+		.epoch = 1,
+		.tickRate = tickRate,
+		.snapshotEvery = snapshotEvery,
+	};
+	pthread_mutex_init(&sim.lock, NULL);
+
+	pthread_t simThread;
+	assert(pthread_create(&simThread, NULL, sim_thread, &sim) == 0);
 
-	enum RENDERING_MODE renderingMode = RENDER_RELATIVES;
-	long long unsigned iterations = 0;
 	bool exit = false;
-	bool paused = true;
 	bool headless = false;
-	struct timeval frame_start, frame_end;
 
 	while (!exit)
 	{
-		// measure time at the beginning of frame
-		gettimeofday(&frame_start, NULL);
-
 		// handle events
+		TIMING_BEGIN(TIMING_EVENTS);
 		SDL_Event e;
 		while (SDL_PollEvent(&e) != 0)
 		{
@@ -168,21 +423,34 @@ int main(int argc, char *argv[])
 
 			else if (e.type == SDL_KEYDOWN)
 			{
+				// every key, but H, changes the simulation
+				if (e.key.keysym.sym != SDLK_h)
+					sim_lock(&sim);
 
 				switch (e.key.keysym.sym)
 				{
 					FILE *f;
 
 				case SDLK_r:
-					// re-initialize state, when R is pressed
-					cells_quit(state);
-					state = cells_init();
-					iterations = 0;
+					// re-initialize state with the next seed, when R is pressed
+					// the snapshot being written shares genomes with the state
+					checkpoint_wait(sim.checkpoint);
+					cells_quit(sim.state);
+					seed++;
+					printf("Seed %llu\n", (unsigned long long)seed);
+					sim.state = cells_init(width, height, seed, &params, START_DENSITY);
+					cells_set_threads(sim.state, threads);
+					sim.state->tickMode = tickMode;
+					if (relativeThreshold >= 0)
+						sim.state->relativeThreshold = relativeThreshold;
+					sim.iterations = 0;
+					sim.redraw = true;
+					sim.epoch++;
 
 					break;
 
 				case SDLK_SPACE:
-					paused = !paused;
+					sim.paused = !sim.paused;
 					break;
 
 				case SDLK_h:
@@ -191,60 +459,89 @@ int main(int argc, char *argv[])
 
 				// Step by one frame
 				case SDLK_f:
-					cells_update_state(state);
+					sim.step = true;
 					break;
 
 				case SDLK_1:
-					renderingMode = RENDER_ENERGY;
+					sim.renderingMode = RENDER_ENERGY;
+					sim.redraw = true;
+					sim.epoch++;
 					break;
 
 				case SDLK_2:
-					renderingMode = RENDER_RELATIVES;
+					sim.renderingMode = RENDER_RELATIVES;
+					sim.redraw = true;
+					sim.epoch++;
 					break;
 
 				case SDLK_3:
-					renderingMode = RENDER_AGE;
+					sim.renderingMode = RENDER_AGE;
+					sim.redraw = true;
+					sim.epoch++;
 					break;
 
 				case SDLK_4:
-					renderingMode = RENDER_ENERGY_SOURCE;
+					sim.renderingMode = RENDER_ENERGY_SOURCE;
+					sim.redraw = true;
+					sim.epoch++;
 					break;
 
 				case SDLK_s:
-					// save map to the file
-					f = fopen("save.bin", "w");
-
-					fwrite(state->cells, sizeof(struct cell), SIMULATION_WIDTH * SIMULATION_HEIGHT, f);
-
-					fclose(f);
+					// save map to the file in the background
+					if (!checkpoint_start(sim.checkpoint, sim.state))
+						fprintf(stderr, "The previous snapshot is still being written\n");
 
 					break;
 
 				case SDLK_l:
-					// load map from the file
-					f = fopen("save.bin", "r");
+					// load map from the file, once it's completely written
+					checkpoint_wait(sim.checkpoint);
+
+					f = fopen("save.bin", "rb");
+					if (!f)
+					{
+						perror("save.bin");
+						break;
+					}
 
-					fread(state->cells, sizeof(struct cell), SIMULATION_WIDTH * SIMULATION_HEIGHT, f);
+					if (!cells_load(sim.state, f))
+						fprintf(stderr, "Failed to load the simulation, the file is corrupted or saved with another world size\n");
 
 					fclose(f);
+					sim.redraw = true;
+
+					break;
 
 				default:
 					break;
 				}
+
+				if (e.key.keysym.sym != SDLK_h)
+					sim_unlock(&sim);
 			}
 			else if (e.type == SDL_MOUSEBUTTONDOWN)
 			{
 				const int sx = e.button.x / CELL_WIDTH;
 				const int sy = e.button.y / CELL_HEIGHT;
 
+				// world size never changes, so it's read without the lock
+				if (sx < 0 || sy < 0 || sx >= width || sy >= height)
+					continue;
+
 				switch (e.button.button)
 				{
 					struct cell cell;
+					struct util_rng rng;
 					char filename[128];
 					FILE *fp;
 
 				case SDL_BUTTON_MIDDLE:
-					cells_set_cell(state, sx, sy, cells_generate_cell(sx, sy));
+					sim_lock(&sim);
+					rng = util_rng_init(cells_tick_key(sim.state), cells_index(sim.state, sx, sy));
+					cell = cells_generate_cell(&rng, &sim.state->params, sx, sy);
+					cells_set_cell(sim.state, sx, sy, &cell);
+					sim.redraw = true;
+					sim_unlock(&sim);
 					break;
 
 				case SDL_BUTTON_LEFT:
@@ -254,7 +551,10 @@ int main(int argc, char *argv[])
 					fp = fopen(filename, "w");
 					assert(fp);
 
-					cell = *cells_get_cell(state, sx, sy);
+					sim_lock(&sim);
+					cells_get_cell(sim.state, sx, sy, &cell);
+					sim_unlock(&sim);
+
 					assert(fwrite(&cell, sizeof(cell), 1, fp));
 
 					fclose(fp);
@@ -264,6 +564,7 @@ int main(int argc, char *argv[])
 					break;
 
 				case SDL_BUTTON_RIGHT:
+					// the simulation keeps running, while the file name is typed
 					scanf("%127s", filename);
 
 					fp = fopen(filename, "r");
@@ -271,7 +572,13 @@ int main(int argc, char *argv[])
 
 					assert(fread(&cell, sizeof(cell), 1, fp));
 					cell.x = sx, cell.y = sy;
-					cells_set_cell(state, sx, sy, cell);
+					// the id may come from another run, the cell starts a lineage of its own
+					cell.lineage = 0;
+
+					sim_lock(&sim);
+					cells_set_cell(sim.state, sx, sy, &cell);
+					sim.redraw = true;
+					sim_unlock(&sim);
 
 					fclose(fp);
 
@@ -285,29 +592,30 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		if (!headless)
-			render(state, renderingMode);
-
-		if (!paused)
-		{
-			cells_update_state(state);
-			iterations++;
+		TIMING_END(TIMING_EVENTS);
 
-			gettimeofday(&frame_end, NULL);
-			int fps = 1.f / ((frame_end.tv_usec - frame_start.tv_usec) / 1000000.f);
-			if (fps == -1)
-			{ // sometimes this happens, fps is reported as -1 for some reason
-				fps = 0;
-			}
+		// presenting waits for vsync, so frames are shown at display rate, whatever the tick rate is
+		const struct frame *frame = headless ? NULL : frames_acquire(sim.frames);
 
-			if (iterations % 10 == 0)
-				printf("[ iteration %llu ] [ fps %d ] Alive cells: %u\n", iterations, fps, cells_count_alive_cells(state));
+		if (frame)
+		{
+			TIMING_BEGIN(TIMING_RENDER);
+			render(frame);
+			TIMING_END(TIMING_RENDER);
 		}
 		else
-			SDL_Delay(100); // when on pause, run at 10 frames per second
+			SDL_Delay(SIM_IDLE_DELAY_MS);
 	}
 
-	cells_quit(state);
+	sim_lock(&sim);
+	sim.quit = true;
+	sim_unlock(&sim);
+	pthread_join(simThread, NULL);
+
+	checkpoint_destroy(sim.checkpoint);
+	cells_quit(sim.state);
+	frames_destroy(sim.frames);
+	pthread_mutex_destroy(&sim.lock);
 	quit();
 
 	return 0;
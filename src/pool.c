@@ -0,0 +1,158 @@
+#include "pool.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct pool
+{
+	pthread_t *threads;
+	unsigned count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+
+	// bumped on every batch, so sleeping workers know there's new work
+	unsigned long generation;
+	bool quit;
+
+	// current batch
+	pool_task task;
+	void *ctx;
+	unsigned tasks;
+	unsigned next;
+	unsigned running;
+};
+
+struct pool_worker
+{
+	struct pool *pool;
+	unsigned index;
+};
+
+// takes tasks from the current batch until it runs out
+static void pool_work(struct pool *pool, const unsigned worker)
+{
+	unsigned task;
+
+	while ((task = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->tasks)
+		pool->task(pool->ctx, task, worker);
+}
+
+static void *pool_thread(void *arg)
+{
+	struct pool_worker *worker = arg;
+	struct pool *pool = worker->pool;
+	const unsigned index = worker->index;
+	unsigned long generation = 0;
+
+	free(worker);
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->lock);
+
+		if (pool->quit)
+			break;
+
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool_work(pool, index);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct pool *pool_create(const unsigned threads)
+{
+	assert(threads > 0);
+
+	struct pool *pool = calloc(1, sizeof(struct pool));
+	assert(pool);
+
+	pool->count = threads - 1;
+	pool->threads = calloc(threads, sizeof(pthread_t));
+	assert(pool->threads);
+
+	assert(pthread_mutex_init(&pool->lock, NULL) == 0);
+	assert(pthread_cond_init(&pool->start, NULL) == 0);
+	assert(pthread_cond_init(&pool->done, NULL) == 0);
+
+	for (unsigned i = 0; i < pool->count; i++)
+	{
+		struct pool_worker *worker = malloc(sizeof(struct pool_worker));
+		assert(worker);
+
+		worker->pool = pool;
+		worker->index = i + 1;
+
+		assert(pthread_create(&pool->threads[i], NULL, pool_thread, worker) == 0);
+	}
+
+	return pool;
+}
+
+void pool_destroy(struct pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (unsigned i = 0; i < pool->count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->threads);
+	free(pool);
+}
+
+unsigned pool_threads(const struct pool *pool)
+{
+	return pool->count + 1;
+}
+
+void pool_run(struct pool *pool, pool_task task, void *ctx, const unsigned tasks)
+{
+	if (pool->count == 0 || tasks <= 1)
+	{
+		for (unsigned i = 0; i < tasks; i++)
+			task(ctx, i, 0);
+
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->ctx = ctx;
+	pool->tasks = tasks;
+	pool->next = 0;
+	pool->running = pool->count;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	// calling thread helps too
+	pool_work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->running > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
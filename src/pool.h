@@ -0,0 +1,21 @@
+#ifndef POOL_H
+#define POOL_H
+
+// task callback, worker is 0 for the calling thread and 1..threads-1 for pool threads
+typedef void (*pool_task)(void *ctx, const unsigned task, const unsigned worker);
+
+// fixed set of threads, which run batches of tasks
+struct pool;
+
+// creates pool with given number of threads, calling thread counts as one of them
+struct pool *pool_create(const unsigned threads);
+
+void pool_destroy(struct pool *pool);
+
+// number of threads, including calling one
+unsigned pool_threads(const struct pool *pool);
+
+// runs tasks 0..tasks-1 in parallel and waits until all of them finish
+void pool_run(struct pool *pool, pool_task task, void *ctx, const unsigned tasks);
+
+#endif
@@ -0,0 +1,247 @@
+#include "render.h"
+#include "defines.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline uint32_t render_channel(const float value)
+{
+	// same as truncating and then clamping to 0..255
+	return (uint32_t)(int)(value < 0.f ? 0.f : (value > 255.f ? 255.f : value));
+}
+
+static inline uint32_t render_pack(const float r, const float g, const float b)
+{
+	return 0xff000000u | render_channel(r) << 16 | render_channel(g) << 8 | render_channel(b);
+}
+
+// dead cells are grey and empty slots black, whatever the mode is
+static inline uint32_t render_select(const bool empty, const bool alive, const uint32_t color)
+{
+	return empty ? RENDER_EMPTY_PIXEL : (alive ? color : RENDER_DEAD_PIXEL);
+}
+
+#ifdef __SSE2__
+// 0xffffffff in every lane, whose byte is set
+static inline __m128i render_mask4(const bool *flags)
+{
+	int32_t bytes;
+	memcpy(&bytes, flags, sizeof(bytes));
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lanes = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+
+	return _mm_xor_si128(_mm_cmpeq_epi32(lanes, zero), _mm_set1_epi32(-1));
+}
+
+static inline __m128i render_channel4(const __m128 value)
+{
+	return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(255.f)));
+}
+
+// splits four x, y, z triples into one vector per field
+static inline void render_deinterleave4(const __m128 t0, const __m128 t1, const __m128 t2, __m128 *x, __m128 *y, __m128 *z)
+{
+	// x2 y2 x3 y3
+	const __m128 high = _mm_shuffle_ps(t1, t2, _MM_SHUFFLE(2, 1, 3, 2));
+
+	*x = _mm_shuffle_ps(t0, high, _MM_SHUFFLE(2, 0, 3, 0));
+	*y = _mm_shuffle_ps(_mm_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 0, 2, 1)), high, _MM_SHUFFLE(3, 1, 2, 0));
+	*z = _mm_shuffle_ps(_mm_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 1, 2, 2)), t2, _MM_SHUFFLE(3, 0, 2, 0));
+}
+
+// packs and stores pixels of four cells, same as render_select(render_pack()) for each
+static inline void render_store4(uint32_t *row, const __m128 r, const __m128 g, const __m128 b, const bool *empty, const bool *alive)
+{
+	__m128i color = _mm_or_si128(_mm_set1_epi32(0xff000000u), _mm_slli_epi32(render_channel4(r), 16));
+	color = _mm_or_si128(color, _mm_slli_epi32(render_channel4(g), 8));
+	color = _mm_or_si128(color, render_channel4(b));
+
+	const __m128i aliveMask = render_mask4(alive);
+	const __m128i emptyMask = render_mask4(empty);
+
+	__m128i pixel = _mm_or_si128(_mm_and_si128(aliveMask, color), _mm_andnot_si128(aliveMask, _mm_set1_epi32(RENDER_DEAD_PIXEL)));
+	pixel = _mm_or_si128(_mm_andnot_si128(emptyMask, pixel), _mm_and_si128(emptyMask, _mm_set1_epi32(RENDER_EMPTY_PIXEL)));
+
+	_mm_storeu_si128((__m128i *)row, pixel);
+}
+#endif
+
+static void render_row_relatives(const struct cells_state *state, const size_t start, const unsigned width, uint32_t *row)
+{
+	const bool *empty = state->empty + start;
+	const bool *alive = state->alive + start;
+	const struct cell_color *colors = state->colors + start;
+	unsigned x = 0;
+
+#ifdef __SSE2__
+	for (; x + 4 <= width; x += 4)
+	{
+		const float *c = &colors[x].r;
+		__m128 r, g, b;
+
+		render_deinterleave4(_mm_loadu_ps(c), _mm_loadu_ps(c + 4), _mm_loadu_ps(c + 8), &r, &g, &b);
+		render_store4(row + x, r, g, b, empty + x, alive + x);
+	}
+#endif
+
+	for (; x < width; x++)
+		row[x] = render_select(empty[x], alive[x], render_pack(colors[x].r, colors[x].g, colors[x].b));
+}
+
+static void render_row_energy(const struct cells_state *state, const size_t start, const unsigned width, uint32_t *row)
+{
+	const bool *empty = state->empty + start;
+	const bool *alive = state->alive + start;
+	const float *energy = state->energy + start;
+	const float maxEnergy = state->params.reproductionEnergy * 2.f;
+	unsigned x = 0;
+
+#ifdef __SSE2__
+	const __m128 scale = _mm_set1_ps(maxEnergy);
+
+	for (; x + 4 <= width; x += 4)
+	{
+		const __m128 value = _mm_mul_ps(_mm_div_ps(_mm_loadu_ps(energy + x), scale), _mm_set1_ps(255.f));
+		render_store4(row + x, value, value, _mm_setzero_ps(), empty + x, alive + x);
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		const float value = energy[x] / maxEnergy * 255.f;
+		row[x] = render_select(empty[x], alive[x], render_pack(value, value, 0.f));
+	}
+}
+
+static void render_row_age(const struct cells_state *state, const size_t start, const unsigned width, uint32_t *row)
+{
+	const bool *empty = state->empty + start;
+	const bool *alive = state->alive + start;
+	const unsigned *age = state->age + start;
+	const float maxAge = state->params.maxAge;
+	unsigned x = 0;
+
+#ifdef __SSE2__
+	// ages never get near 2^31, so they convert as signed
+	for (; x + 4 <= width; x += 4)
+	{
+		const __m128 fraction = _mm_div_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(age + x))), _mm_set1_ps(maxAge));
+		const __m128 value = _mm_add_ps(_mm_set1_ps(50), _mm_mul_ps(_mm_set1_ps(255.f), fraction));
+		render_store4(row + x, _mm_setzero_ps(), _mm_setzero_ps(), value, empty + x, alive + x);
+	}
+#endif
+
+	for (; x < width; x++)
+		row[x] = render_select(empty[x], alive[x], render_pack(0.f, 0.f, 50 + 255.f * ((float)age[x] / maxAge)));
+}
+
+static void render_row_energy_source(const struct cells_state *state, const size_t start, const unsigned width, uint32_t *row)
+{
+	const bool *empty = state->empty + start;
+	const bool *alive = state->alive + start;
+	const struct cell_counters *counters = state->counters + start;
+	unsigned x = 0;
+
+#ifdef __SSE2__
+	for (; x + 4 <= width; x += 4)
+	{
+		// counters never get near 2^31, so they convert as signed
+		const __m128i *c = (const __m128i *)&counters[x];
+		__m128 photosynthesis, attack, eating;
+
+		render_deinterleave4(_mm_cvtepi32_ps(_mm_loadu_si128(c)), _mm_cvtepi32_ps(_mm_loadu_si128(c + 1)),
+							 _mm_cvtepi32_ps(_mm_loadu_si128(c + 2)), &photosynthesis, &attack, &eating);
+
+		__m128 max = _mm_max_ps(_mm_max_ps(attack, photosynthesis), eating);
+		max = _mm_max_ps(max, _mm_set1_ps(1.f));
+
+		const __m128 scale = _mm_set1_ps(255.f);
+		render_store4(row + x, _mm_mul_ps(_mm_div_ps(attack, max), scale), _mm_mul_ps(_mm_div_ps(photosynthesis, max), scale),
+					  _mm_mul_ps(_mm_div_ps(eating, max), scale), empty + x, alive + x);
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		const float attack = counters[x].attackCount;
+		const float photosynthesis = counters[x].photosynthesisCount;
+		const float eating = counters[x].eatingDeadCount;
+
+		// counters are whole numbers, so a cell, which never got any energy, is black instead of 0 / 0
+		float max = attack > photosynthesis ? attack : photosynthesis;
+		max = eating > max ? eating : max;
+		max = max > 1.f ? max : 1.f;
+
+		row[x] = render_select(empty[x], alive[x], render_pack(attack / max * 255.f, photosynthesis / max * 255.f, eating / max * 255.f));
+	}
+}
+
+typedef void (*render_row)(const struct cells_state *state, const size_t start, const unsigned width, uint32_t *row);
+
+static render_row render_row_for(const enum RENDERING_MODE renderingMode)
+{
+	switch (renderingMode)
+	{
+	case RENDER_ENERGY:
+		return render_row_energy;
+	case RENDER_AGE:
+		return render_row_age;
+	case RENDER_ENERGY_SOURCE:
+		return render_row_energy_source;
+	default:
+		return render_row_relatives;
+	}
+}
+
+void render_pixels(const struct cells_state *state, const enum RENDERING_MODE renderingMode, uint32_t *pixels, const size_t pitch)
+{
+	const render_row row = render_row_for(renderingMode);
+
+	for (unsigned y = 0; y < state->height; y++)
+		row(state, (size_t)y * state->width, state->width, (uint32_t *)((uint8_t *)pixels + y * pitch));
+}
+
+void render_pixels_since(const struct cells_state *state, const enum RENDERING_MODE renderingMode, uint32_t *pixels, const size_t pitch,
+						 const unsigned long long version)
+{
+	if (renderingMode != RENDER_RELATIVES)
+	{
+		render_pixels(state, renderingMode, pixels, pitch);
+		return;
+	}
+
+	const render_row row = render_row_for(renderingMode);
+	const size_t size = (size_t)state->width * state->height;
+	const size_t spans = cells_span_count(state);
+
+	for (size_t span = 0; span < spans; span++)
+	{
+		if (!cells_span_changed(state, span, version))
+			continue;
+
+		// neighbouring changed spans are drawn as one run
+		size_t last = span + 1;
+		while (last < spans && cells_span_changed(state, last, version))
+			last++;
+
+		size_t index = span * SPAN_SIZE;
+		const size_t end = last * SPAN_SIZE < size ? last * SPAN_SIZE : size;
+
+		// spans follow the index, so a run can go on to the next rows
+		while (index < end)
+		{
+			const unsigned y = index / state->width, x = index % state->width;
+			const size_t rowEnd = (size_t)(y + 1) * state->width;
+			const unsigned count = (end < rowEnd ? end : rowEnd) - index;
+
+			row(state, index, count, (uint32_t *)((uint8_t *)pixels + y * pitch) + x);
+			index += count;
+		}
+
+		span = last;
+	}
+}
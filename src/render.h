@@ -0,0 +1,36 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cells.h"
+
+enum RENDERING_MODE
+{
+	RENDER_ENERGY,
+	RENDER_RELATIVES,
+	RENDER_AGE,
+	RENDER_ENERGY_SOURCE
+};
+
+// pixels are 0xAARRGGBB, SDL_PIXELFORMAT_ARGB8888
+#define RENDER_EMPTY_PIXEL 0xff000000u
+#define RENDER_DEAD_PIXEL 0xff464646u
+
+/*
+	Colours the whole world, one pixel per cell, into rows of pitch bytes.
+	Every mode is a separate loop, which colours four cells at a time with
+	SSE2, and the result is uploaded to a texture in one go.
+*/
+void render_pixels(const struct cells_state *state, const enum RENDERING_MODE renderingMode, uint32_t *pixels, const size_t pitch);
+
+/*
+	Same as render_pixels(), but only for cells which changed after given
+	state version, the rest of pixels has to be drawn at that version with
+	the same mode. Only RENDER_RELATIVES depends on nothing but the tracked
+	changes, other modes show energy or age and are always drawn whole.
+*/
+void render_pixels_since(const struct cells_state *state, const enum RENDERING_MODE renderingMode, uint32_t *pixels, const size_t pitch,
+						 const unsigned long long version);
+
+#endif
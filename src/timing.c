@@ -0,0 +1,79 @@
+#include "timing.h"
+
+#ifdef CELLS_TIMING
+
+#include <stdlib.h>
+#include <time.h>
+
+struct timing_ring
+{
+	uint64_t samples[TIMING_SAMPLES];
+	// samples recorded so far, the next one goes to count % TIMING_SAMPLES
+	unsigned long long count;
+};
+
+static struct timing_ring timing_rings[TIMING_PHASES];
+
+static const char *timing_names[] = {
+	[TIMING_EVENTS] = "events",
+	[TIMING_TICK] = "tick",
+	[TIMING_STATS] = "stats",
+	[TIMING_COLOR] = "color",
+	[TIMING_RENDER] = "render",
+};
+
+uint64_t timing_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void timing_record(const enum timing_phase phase, const uint64_t nanoseconds)
+{
+	struct timing_ring *ring = &timing_rings[phase];
+
+	// only the timing thread writes, relaxed atomics keep reports from other threads tear-free
+	const unsigned long long count = ring->count;
+	__atomic_store_n(&ring->samples[count % TIMING_SAMPLES], nanoseconds, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->count, count + 1, __ATOMIC_RELAXED);
+}
+
+static int timing_compare(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+// nearest rank of sorted samples, in milliseconds
+static double timing_percentile(const uint64_t *sorted, const unsigned n, const unsigned percent)
+{
+	return sorted[(n - 1) * percent / 100] / 1e6;
+}
+
+void timing_report(FILE *f)
+{
+	for (int phase = 0; phase < TIMING_PHASES; phase++)
+	{
+		const struct timing_ring *ring = &timing_rings[phase];
+		const unsigned long long count = __atomic_load_n(&ring->count, __ATOMIC_RELAXED);
+		const unsigned n = count < TIMING_SAMPLES ? count : TIMING_SAMPLES;
+
+		if (!n)
+			continue;
+
+		uint64_t sorted[TIMING_SAMPLES];
+		for (unsigned i = 0; i < n; i++)
+			sorted[i] = __atomic_load_n(&ring->samples[i], __ATOMIC_RELAXED);
+
+		qsort(sorted, n, sizeof(uint64_t), timing_compare);
+
+		fprintf(f, "[ timing %-6s ] p50 %.3f p90 %.3f p99 %.3f max %.3f ms, last %u of %llu\n", timing_names[phase],
+				timing_percentile(sorted, n, 50), timing_percentile(sorted, n, 90), timing_percentile(sorted, n, 99),
+				timing_percentile(sorted, n, 100), n, count);
+	}
+}
+
+#endif
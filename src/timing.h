@@ -0,0 +1,55 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+	Timers around the hot paths, built only with CELLS_TIMING defined
+	( make TIMING=1 ), otherwise the macros below expand to nothing and
+	nothing is measured. Every phase keeps its last TIMING_SAMPLES
+	durations, percentiles are taken from them when they're reported,
+	so they follow what happened lately. A phase has to be timed by one
+	thread only, reports can come from any thread.
+*/
+
+enum timing_phase
+{
+	// event loop handling input
+	TIMING_EVENTS,
+	// cells_update_state()
+	TIMING_TICK,
+	// printing stats and starting snapshots
+	TIMING_STATS,
+	// colouring a frame
+	TIMING_COLOR,
+	// uploading and presenting a frame
+	TIMING_RENDER,
+	TIMING_PHASES,
+};
+
+#define TIMING_SAMPLES 256
+
+#ifdef CELLS_TIMING
+
+// nanoseconds of CLOCK_MONOTONIC
+uint64_t timing_now(void);
+
+void timing_record(const enum timing_phase phase, const uint64_t nanoseconds);
+
+// prints a line of percentiles for every phase, which was timed
+void timing_report(FILE *f);
+
+#define TIMING_BEGIN(phase) const uint64_t timing_start_##phase = timing_now()
+#define TIMING_END(phase) timing_record(phase, timing_now() - timing_start_##phase)
+#define TIMING_REPORT(f) timing_report(f)
+
+#else
+
+#define TIMING_BEGIN(phase)
+#define TIMING_END(phase)
+#define TIMING_REPORT(f)
+
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
 
 // yes, this code is very slooow,
 // but it is only used once in cell state initialization
@@ -33,4 +35,65 @@ __attribute__((noreturn)) void util_panic(const char *fmt, ...)
 
 	fprintf(stderr, "PANIC; REASON: %s\n", buf);
 	exit(EXIT_FAILURE);
-}
\ No newline at end of file
+}
+
+uint64_t util_parse_number(const char *option, const char *value, const uint64_t min, const uint64_t max)
+{
+	char *end;
+	errno = 0;
+	unsigned long long number = strtoull(value, &end, 0);
+
+	if (*value == '\0' || *value == '-' || *end != '\0' || errno == ERANGE || number < min || number > max)
+	{
+		fprintf(stderr, "invalid value '%s' for %s, expected number from %llu to %llu\n",
+				value, option, (unsigned long long)min, (unsigned long long)max);
+		exit(EXIT_FAILURE);
+	}
+
+	return number;
+}
+
+double util_parse_float(const char *option, const char *value, const double min, const double max)
+{
+	char *end;
+	errno = 0;
+	double number = strtod(value, &end);
+
+	// comparisons are false for NaN
+	if (*value == '\0' || *end != '\0' || errno == ERANGE || !(number >= min && number <= max))
+	{
+		fprintf(stderr, "invalid value '%s' for %s, expected number from %g to %g\n", value, option, min, max);
+		exit(EXIT_FAILURE);
+	}
+
+	return number;
+}
+
+static uint32_t util_crc32_table[256];
+static pthread_once_t util_crc32_once = PTHREAD_ONCE_INIT;
+
+static void util_crc32_init()
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t crc = i;
+
+		for (int bit = 0; bit < 8; bit++)
+			crc = crc & 1 ? 0xedb88320u ^ crc >> 1 : crc >> 1;
+
+		util_crc32_table[i] = crc;
+	}
+}
+
+uint32_t util_crc32(uint32_t crc, const void *data, const size_t size)
+{
+	const uint8_t *bytes = data;
+
+	pthread_once(&util_crc32_once, util_crc32_init);
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = util_crc32_table[(crc ^ bytes[i]) & 0xff] ^ crc >> 8;
+
+	return ~crc;
+}
@@ -1,6 +1,10 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #define util_clamp(val, min, max) (val > max) ? max : ((val < min) ? min : val)
 #define util_random(from, to) from + rand() % (to + 1 - from)
 
@@ -13,6 +17,65 @@
 void util_shuffle(unsigned *arr, const unsigned length, const unsigned times);
 __attribute__((noreturn)) void util_panic(const char *fmt, ...);
 
+// parses numeric command line option, exits with an error message on garbage or out of range value
+uint64_t util_parse_number(const char *option, const char *value, const uint64_t min, const uint64_t max);
+
+// same as util_parse_number(), for real numbers
+double util_parse_float(const char *option, const char *value, const double min, const double max);
+
+// continues CRC-32 ( as in zlib ) of earlier data with given bytes, start with crc = 0
+uint32_t util_crc32(uint32_t crc, const void *data, const size_t size);
+
+/*
+	Counter-based random numbers.
+	n-th number of a stream is just a hash of ( key, n ), so there's no
+	shared state: any stream can be recreated from its key, and streams can
+	be generated on any thread in any order.
+*/
+struct util_rng
+{
+	uint64_t key;
+	uint64_t counter;
+};
+
+// splitmix64 finalizer
+static inline uint64_t util_hash64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+// derives key of a sub-stream, e.g. util_rng_key(util_rng_key(seed, tick), cell)
+static inline uint64_t util_rng_key(const uint64_t key, const uint64_t id)
+{
+	return util_hash64(key ^ util_hash64(id + 0x9e3779b97f4a7c15ull));
+}
+
+static inline struct util_rng util_rng_init(const uint64_t key, const uint64_t id)
+{
+	return (struct util_rng){util_rng_key(key, id), 0};
+}
+
+static inline uint32_t util_rng_next(struct util_rng *rng)
+{
+	return util_hash64(rng->key + ++rng->counter * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+// random integer in [from, to]
+static inline int util_rng_range(struct util_rng *rng, const int from, const int to)
+{
+	return from + (int)(((uint64_t)util_rng_next(rng) * (uint32_t)(to + 1 - from)) >> 32);
+}
+
+static inline bool util_rng_bool(struct util_rng *rng)
+{
+	return util_rng_next(rng) >> 31;
+}
+
 inline float util_max(unsigned int size, float values[size])
 {
     if (size == 0)